@@ -19,7 +19,6 @@ int targetGameNode = MASTER_MIND_POT_GAME_NODE;
 
 long lastHeartbeatPing = 0;
 int pingSendCount = 0;
-String PING_STR = "Ping ";
 bool shouldSendHeartbeat = false;
 
 // **************************************
@@ -82,15 +81,6 @@ void receiveCommEvent() {
     case CE_RESET_PUZZLE:
       Serial.print(F("Received RESET event."));
       break;
-    case CE_PONG:
-      Serial.print(F("Received PONG event."));
-      break;
-    case CE_PING:
-      Serial.print(F("Received PING event: "));
-      Serial.println(eventData.data);
-      sendEventToNode(targetGameNode, CE_PONG, "pong");
-      Serial.print(F("Send PONG event."));
-      break;
     case CE_PLAY_TRACK:
       Serial.print(F("Received Play Audio Track event: "));
       Serial.print(eventData.data);
@@ -101,9 +91,6 @@ void receiveCommEvent() {
       Serial.print(eventData.data);
       respondAckToSender();
       break;
-    case CE_ACK:
-      Serial.print(F("Received ACK."));
-      break;
     default:
       Serial.print(F("Received something unknown at this point."));
   }
@@ -198,8 +185,7 @@ void sendHeartbeatPing() {
     pingSendCount++;
     Serial.print(F("Sending ping "));
     Serial.println(pingSendCount);
-    String s = PING_STR + pingSendCount;
-    sendEventToNode(targetGameNode, CE_PING, s);
+    sendIntEventToNode(targetGameNode, CE_PING, pingSendCount);
     lastHeartbeatPing = millis(); 
   }
 }
@@ -19,7 +19,6 @@
 int targetNode = GAME_CONTROLLER_NODE;
 
 int pingSendCount = 0;
-String PING_STR = "Ping ";
 
 // Local method declarations
 void dump_byte_array(byte *buffer, byte bufferSize);
@@ -84,18 +83,6 @@ void receiveCommEvent() {
     case CE_RESET_NODE:
       Serial.print(F("**Received RESET event."));
       break;
-    case CE_PONG:
-      Serial.print(F("++Received PONG event."));
-      break;
-    case CE_PING:
-      Serial.print(F("--Received PING event: Length: "));
-      Serial.print(strlen(eventData.data));
-      Serial.print(F(", Data: ["));
-      Serial.print(eventData.data);
-      Serial.println(F("]"));
-      sendEventToNode(targetNode, CE_PONG, "pong");
-      //Serial.print(F("--Send PONG event."));
-      break;
       case CE_PLAY_TRACK:
         Serial.println("GOT PLAY TRACK EVENT");
         Serial.println(eventData.data);
@@ -195,8 +182,7 @@ void sendHeartbeatPing() {
     pingSendCount++;
     Serial.print(F("++Sending ping "));
     Serial.println(pingSendCount);
-    String s = PING_STR + pingSendCount;
-    sendEventToNode(targetNode, CE_PING, s);
+    sendIntEventToNode(targetNode, CE_PING, pingSendCount);
     lastHeartbeatPing = millis(); 
   }
 }
@@ -886,7 +886,7 @@ public:
        reset();
        gameInProgress = false;
 	   numberOfAttempts = 0;
-       sendControllerImportantEvent(CE_PUZZLE_COMPLETED,CE_PUZZLE_COMPLETED_SUCCESS,FISH_SORTING_GAME_NODE);
+       sendGameRequest<PuzzleCompletedEvent>(GAME_CONTROLLER_NODE, FISH_SORTING_GAME_NODE, NULL);
 
 
     } 
@@ -979,6 +979,22 @@ public:
     bool getGameStatusChanged() {
         return gameStatusChanged;
     }
+
+    bool isGameActivated() {
+        return gameActivated;
+    }
+
+    bool isGameInProgress() {
+        return gameInProgress;
+    }
+
+    int getCurrentSequencePosition() {
+        return currentSequencePosition;
+    }
+
+    unsigned int getNumberOfAttempts() {
+        return numberOfAttempts;
+    }
  
 ////////////////////////////////////////////////
 // Create a random solution with the following
@@ -1116,6 +1132,11 @@ public:
 // **********************************************************************************
 FishSortingGame* fsGame; // This is the main game object
 
+// State record mirrored to the controller with setStateField()
+#define FS_STATE_PHASE              0   // 0 waiting, 1 activated, 2 in progress
+#define FS_STATE_SEQUENCE_POSITION  1
+#define FS_STATE_ATTEMPTS           2
+
 RFIDTag tagsForFishSpecies[NUM_FISH_SPECIES][NUM_FISH_PER_SPECIES] = {
     { RFIDTag(0x3B, 0x03, 0xFE, 0xC4), RFIDTag(0x6B, 0xA0, 0xFF, 0xC4), RFIDTag(0x6B, 0xBC, 0xFD, 0xC4), RFIDTag(0x5B, 0xB0, 0xFF, 0xC4) },   // red fish ID's
     { RFIDTag(0xAB, 0xB2, 0x06, 0xC5), RFIDTag(0x6B, 0xED, 0xFD, 0xC4), RFIDTag(0x8B, 0x4C, 0x08, 0xC5), RFIDTag(0x5B, 0x57, 0x21, 0xC5) },   // yellow fish ID's
@@ -1185,15 +1206,14 @@ void receiveCommEvent() {
 }
 
 
+ // Wait in place while the other scheduler tasks (comm) keep running. Only the post flashing does this,
+ // the game loop task that called it is skipped until it returns.
  void momentaryComm(unsigned long howlong) {
   
 #ifdef DO_DEBUG
 // Serial.print(F("------Momentary Comm START----"));Serial.println(howlong);
 #endif
-    unsigned long start = millis();
-    while(millis()-start < howlong) {
-      doComm();
-    }
+    runSchedulerFor(howlong);
   
 #ifdef DO_DEBUG
  //Serial.println(F("------Momentary Comm END----"));
@@ -1261,6 +1281,11 @@ void setup() {
     initializeFishSortingGame();
     resetNode(true);
 
+#ifdef DO_GAME_EVENT_COMM
+    schedulePeriodic(0, commTask);
+#endif
+    schedulePeriodic(0, gameLoopTask);
+
 #ifdef GAME_ACTIVATE_EVENT_NOT_REQUIRED
 //    fsGame->activateGame();
 #endif
@@ -1276,12 +1301,14 @@ void setup() {
 
 void loop() {
 
-#ifdef DO_GAME_EVENT_COMM
-    doComm();
-#endif
-    
+    runScheduler();
+ 
+}
+
+void gameLoopTask(int arg) {
     if(!testModeOnly) {
         fsGame->processGameLoop();
+        updateStateRecord();
       
 #ifdef DO_DEBUG
       if ( fsGame->getGameStatusChanged() ) {   //|| (millis() - fsGame->lastPrintTime) > 5000) {
@@ -1296,12 +1323,21 @@ void loop() {
  
 }
 
+/**
+ * Copy the game progress into the state record. Only the fields that changed go to the controller.
+ */
+void updateStateRecord() {
+    setStateField(FS_STATE_PHASE, fsGame->isGameInProgress() ? 2 : (fsGame->isGameActivated() ? 1 : 0));
+    setStateField(FS_STATE_SEQUENCE_POSITION, fsGame->getCurrentSequencePosition());
+    setStateField(FS_STATE_ATTEMPTS, fsGame->getNumberOfAttempts());
+}
+
 
 /***************
 * Play Track. 
 * Just a convenience to send a play track event
 **************/
-  void playTrack(String track) {
+  void playTrack(const char *track) {
 //      sendEventToController(CE_PLAY_TRACK ,rack);  
       Serial.println(F("Sending event"));
 
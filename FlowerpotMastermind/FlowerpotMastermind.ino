@@ -112,7 +112,7 @@ static byte tagIdsByFlowerPot[NUM_KNOWN_FLOWER_POTS][2][4] = {
 // Local functions
 void printBegin(String s);
 void printEnd(String s);
-void processReceivedStartGame();
+void processReceivedStartGame(int arg);
 void processSendEvents();
 
 
@@ -782,7 +782,27 @@ Serial.println(solutionFoundTimeMillis);
 // This is the main game object
 MasterMindFlowerPotGame* mmGameInstance;
 int numberOfAttempts = 0;
-String repeatTrack;
+const char *repeatTrack;
+
+// Timing of the start and end of the game. Nothing blocks, these are scheduler delays.
+#define START_GAME_DELAY_MILLIS    1500   // After answering the start event, before the game starts
+#define INSTRUCTIONS_MILLIS        10000  // Instructions track playing, pots are not looked at yet
+#define COMPLETED_TRACK_MILLIS     10000  // Winning track playing, before the controller is told
+
+bool instructionsPlaying = false;
+GameTaskHandle startGameTask = NO_GAME_TASK;
+GameTaskHandle instructionsTask = NO_GAME_TASK;
+GameTaskHandle reportCompletedTask = NO_GAME_TASK;
+
+// State record mirrored to the controller with setStateField()
+#define MM_STATE_PHASE            0   // 0 waiting, 1 playing, 2 finished
+#define MM_STATE_POTS_ON_READERS  1
+#define MM_STATE_CORRECT_POTS     2
+#define MM_STATE_ATTEMPTS         3
+#define MM_STATE_SOLUTION         4
+#define MM_STATE_READERS          5   // Bit per reader with a pot on it
+#define MM_STATE_FIRST_POT_SECS   6   // Seconds from the game start to the first pot, 0 until then
+#define MM_STATE_SOLVED_SECS      7   // Seconds from the game start to the solution, 0 until then
 /**
  * Arduino initialization entry point.
  */
@@ -808,6 +828,12 @@ void setup() {
 
   // Initialize game event communications
   initializeGameEventComm();
+
+  // Everything loop() does is a scheduler task
+#ifdef DO_GAME_EVENT_COMM
+  schedulePeriodic(0, commTask);
+#endif
+  schedulePeriodic(0, gameLoopTask);
   
 
 #ifdef GAME_START_EVENT_NOT_REQUIRED
@@ -944,41 +970,33 @@ void receiveCommEvent() {
     Serial.println(F("Recieve Puzzle Start Event"));    
       Serial.println(F("Sending puzzle start success"));
       sendPuzzleStartSuccess();
-      momentaryComm(1000);
-      processReceivedStartGame();
+      cancelTask(startGameTask);
+      startGameTask = scheduleAfter(START_GAME_DELAY_MILLIS, processReceivedStartGame);
 //      respondAckToSender();
       break;
-    case CE_PING:
-#ifdef DO_DEBUG_GAME_COMM    
-      Serial.print(F("Rcv PING: ["));
-      Serial.print(eventData.data);
-      Serial.println(F("]"));
-#endif
-      sendEventToNode(CONTROLLER_NODE, CE_PONG, "pong");
-      break;
-    case CE_ACK:
-      Serial.print(F("Rcv ACK. ["));
-      Serial.print(eventData.data);
-      Serial.println(F("]"));
-     break;
     default:
       ;
   }
 }
 
 void reset() {
+  cancelTask(startGameTask);
+  cancelTask(instructionsTask);
+  cancelTask(reportCompletedTask);
+  instructionsPlaying = false;
   mmGameInstance->reset(); 
   numberOfAttempts = 0;      
   mmGameInstance->setGameStarted(false);
+  clearStateFields();
   sendEventToNode(MP3_PLAYER_NODE,CE_PLAY_TRACK, "reset40");
 }
 
-void processReceivedStartGame() {
-  momentaryComm(500);
+void processReceivedStartGame(int arg) {
+  startGameTask = NO_GAME_TASK;
   mmGameInstance->processStartGame();
   // Play the tracks to start the game
   uint8_t  whichSolution = mmGameInstance->getGameSolutionNumber();
-  String startTrack = "track11";
+  const char *startTrack = "track11";
   repeatTrack="track11r";
   if(whichSolution == 1) {
     startTrack = "track12";
@@ -994,7 +1012,14 @@ void processReceivedStartGame() {
   
  // This is a short version for testing. uncomment above and get rid of this when ready 
     sendAudioEvent(repeatTrack);
-  momentaryComm(10000);
+  instructionsPlaying = true;
+  cancelTask(instructionsTask);
+  instructionsTask = scheduleAfter(INSTRUCTIONS_MILLIS, instructionsFinished);
+}
+
+void instructionsFinished(int arg) {
+  instructionsTask = NO_GAME_TASK;
+  instructionsPlaying = false;
 }
 
 
@@ -1004,21 +1029,46 @@ void processReceivedStartGame() {
 // **********************************************************************************
 void loop() {
 
-// Event communications
-#ifdef DO_GAME_EVENT_COMM
-  doComm();
-#endif
+  // Event communications and the game update are scheduler tasks
+  runScheduler();
+  
+}
 
-  // Update the game
+void gameLoopTask(int arg) {
   processGameLoopIteration();
-  
+  updateStateRecord(mmGameInstance);
+}
+
+/**
+ * Copy the game counters into the state record. Only the fields that changed go to the controller.
+ */
+void updateStateRecord(MasterMindFlowerPotGame* mmGame) {
+  uint16_t phase = mmGame->isGameFinished() ? 2 : (mmGame->isGameStarted() ? 1 : 0);
+  uint16_t readersWithPots = 0;
+  for (uint8_t reader = 0; reader < mmGame->getNumReaders(); reader++) {
+    if (mmGame->getReader(reader)->isTagPresent()) {
+      readersWithPots |= 1 << reader;
+    }
+  }
+  long startTime = mmGame->getGameStartTimeMillis();
+
+  setStateField(MM_STATE_PHASE, phase);
+  setStateField(MM_STATE_POTS_ON_READERS, mmGame->getNumberFlowerPotsOnReaders());
+  setStateField(MM_STATE_CORRECT_POTS, mmGame->getNumberCorrectFlowerPots());
+  setStateField(MM_STATE_ATTEMPTS, numberOfAttempts);
+  setStateField(MM_STATE_SOLUTION, mmGame->getGameSolutionNumber());
+  setStateField(MM_STATE_READERS, readersWithPots);
+  setStateField(MM_STATE_FIRST_POT_SECS, mmGame->getFirstPotTimeMillis() == 0 ? 0 :
+                                         (mmGame->getFirstPotTimeMillis() - startTime) / 1000);
+  setStateField(MM_STATE_SOLVED_SECS, mmGame->getSolutionFoundTimeMillis() == 0 ? 0 :
+                                      (mmGame->getSolutionFoundTimeMillis() - startTime) / 1000);
 }
 
 /**
  * Main loop processing of the game.
  */
 void processGameLoopIteration() {
-  if (mmGameInstance->isGameStarted()) {
+  if (mmGameInstance->isGameStarted() && !instructionsPlaying) {
     mmGameInstance->updateGameStatus();
 
     doComm();
@@ -1127,17 +1177,21 @@ void gameCompleted() {
       } else {
          sendAudioEvent(AUDIO_ALL_CORRECT_GUESS_SLOW);
       }
-      // Do comm for the length of the track and then tell the node you are done
-      momentaryComm(10000);
-      sendControllerImportantEvent(CE_PUZZLE_COMPLETED,CE_PUZZLE_COMPLETED_SUCCESS,MASTER_MIND_POT_GAME_NODE);
       mmGameInstance->setGameStarted(false);
       mmGameInstance->setGameFinished(true);
+      // Let the track play and then tell the controller you are done
+      cancelTask(reportCompletedTask);
+      reportCompletedTask = scheduleAfter(COMPLETED_TRACK_MILLIS, reportGameCompleted);
+}
 
+void reportGameCompleted(int arg) {
+      reportCompletedTask = NO_GAME_TASK;
+      sendGameRequest<PuzzleCompletedEvent>(GAME_CONTROLLER_NODE, MASTER_MIND_POT_GAME_NODE, NULL);
       reset();
 }
 
-void chooseAndSendAudioEvent(String track1, String track2) {
-  String trackToSend = track1;
+void chooseAndSendAudioEvent(const char *track1, const char *track2) {
+  const char *trackToSend = track1;
 
   int randomTrack = random(0, 2);  // Returns a long value from 0 to value-1 (so 1, in this case)
   if(randomTrack == 1) {
@@ -1147,21 +1201,12 @@ void chooseAndSendAudioEvent(String track1, String track2) {
   sendAudioEvent(trackToSend);
 }
 
-void sendAudioEvent(String audioId) {
+void sendAudioEvent(const char *audioId) {
 #ifdef DO_DEBUG_GAME_COMM    
   Serial.print(F("Send Audio: "));
   Serial.println(audioId);
 #endif  
   sendEventToNode(AUDIO_NODE, CE_PLAY_TRACK, audioId);
-
-    momentaryComm(500);
-}
-
-void momentaryComm(unsigned long len) {
-   unsigned long start = millis();
-   while((millis() - start) < len) {
-      doComm();
-   }
 }
 
 
@@ -0,0 +1,22 @@
+#ifndef AckingBus_h
+#define AckingBus_h
+
+// A PJON strategy for SendBenchmark. Every frame is answered with ACK as soon as it is sent.
+
+#include <PJONDefines.h>
+
+class AckingBus {
+  public:
+    uint32_t back_off(uint8_t attempts) { return attempts; }
+    boolean begin(uint8_t additional_randomness = 0) { return true; }
+    boolean can_start() { return true; }
+    static uint8_t get_max_attempts() { return 10; }
+    void handle_collision() {}
+    uint16_t receive_byte() { return FAIL; }
+    uint16_t receive_response() { return ACK; }
+    void send_response(uint8_t response) {}
+    void send_string(uint8_t *string, uint16_t length) {}
+    void set_pin(uint8_t pin) {}
+};
+
+#endif
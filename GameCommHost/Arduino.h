@@ -0,0 +1,222 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// Just enough of the Arduino core to build GameCommUtils, GameScheduler and PJON on a PC.
+//
+// Time is simulated. micros() reads hostMicros, which only the code itself moves forward: every
+// micros() call costs HOST_MICROS_PER_CALL and delay() / delayMicroseconds() cost what they ask
+// for. The in process bus sets hostMicros to the clock of whichever node is running, so every
+// simulated node has its own clock. Pins do nothing.
+//
+// Serial prints to stdout, but only while hostSerialEcho is set.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define B00000000 0
+#define B00000001 1
+#define B00000010 2
+#define B00000100 4
+#define B00001000 8
+#define B00010000 16
+#define B00100000 32
+#define B01000000 64
+#define B10000000 128
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(a) (*(const uint8_t*)(a))
+#define pgm_read_word(a) (*(const uint16_t*)(a))
+#define pgm_read_dword(a) (*(const uint32_t*)(a))
+#define strlen_P strlen
+#define memcpy_P memcpy
+typedef const char* PGM_P;
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+#define constrain(a, low, high) ((a) < (low) ? (low) : ((a) > (high) ? (high) : (a)))
+#define bitRead(v, b) (((v) >> (b)) & 0x01)
+#define bitWrite(v, b, x) ((x) ? ((v) |= (1UL << (b))) : ((v) &= ~(1UL << (b))))
+
+#ifndef HOST_MICROS_PER_CALL
+#define HOST_MICROS_PER_CALL 1
+#endif
+
+extern uint32_t hostMicros;
+extern bool hostSerialEcho;
+
+inline uint32_t micros() { return hostMicros += HOST_MICROS_PER_CALL; }
+inline uint32_t millis() { return micros() / 1000; }
+inline void delayMicroseconds(uint32_t us) { hostMicros += us; }
+inline void delay(uint32_t ms) { hostMicros += ms * 1000; }
+
+inline long random(long low, long high) { return high > low ? low + rand() % (high - low) : low; }
+inline long random(long high) { return random(0, high); }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int analogRead(uint8_t) { return 0; }
+inline void attachInterrupt(uint8_t, void (*)(), int) {}
+inline void cli() {}
+inline void sei() {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+inline char* itoa(int value, char *buffer, int radix) {
+  sprintf(buffer, radix == 16 ? "%x" : "%d", value);
+  return buffer;
+}
+
+// Arduino's String keeps its text in a buffer from malloc() that is grown with realloc() as the text
+// grows, and so does this one. hostHeap() counts the bytes the Strings hold, with the 2 bytes AVR
+// malloc() adds to every block, so the heap use of String code can be measured on the host.
+struct hostHeapStruct {
+  uint32_t inUse = 0;
+  uint32_t peak = 0;
+  uint32_t allocations = 0;
+};
+
+inline hostHeapStruct &hostHeap() {
+  static hostHeapStruct heap;
+  return heap;
+}
+
+#define HOST_HEAP_BLOCK_OVERHEAD 2
+
+class String {
+  public:
+    String() {}
+    String(const char *text) { copy(text ? text : "", text ? strlen(text) : 0); }
+    String(const __FlashStringHelper *text) : String(reinterpret_cast<const char*>(text)) {}
+    String(int number) { char digits[8]; copy(digits, sprintf(digits, "%d", number)); }
+    String(const String &other) { copy(other.c_str(), other.len); }
+    String(String &&other) : buffer(other.buffer), capacity(other.capacity), len(other.len) {
+      other.buffer = NULL;
+      other.capacity = 0;
+      other.len = 0;
+    }
+    ~String() { release(); }
+    String& operator=(const String &other) {
+      if (this != &other) {
+        copy(other.c_str(), other.len);
+      }
+      return *this;
+    }
+    const char* c_str() const { return buffer ? buffer : ""; }
+    unsigned int length() const { return len; }
+    String operator+(const String &other) const { String sum(*this); sum.concat(other.c_str(), other.len); return sum; }
+    String operator+(int number) const { char digits[8]; String sum(*this); sum.concat(digits, sprintf(digits, "%d", number)); return sum; }
+    String& operator+=(char c) { concat(&c, 1); return *this; }
+    bool equals(const char *other) const { return strcmp(c_str(), other) == 0; }
+
+  private:
+    char *buffer = NULL;
+    unsigned int capacity = 0;
+    unsigned int len = 0;
+
+    bool reserve(unsigned int size) {
+      if (buffer != NULL && capacity >= size) {
+        return true;
+      }
+      char *grown = (char*)realloc(buffer, size + 1);
+      if (grown == NULL) {
+        return false;
+      }
+      hostHeapStruct &heap = hostHeap();
+      if (buffer == NULL) {
+        heap.inUse += size + 1 + HOST_HEAP_BLOCK_OVERHEAD;
+        heap.allocations++;
+      } else {
+        heap.inUse += size - capacity;
+      }
+      if (heap.inUse > heap.peak) {
+        heap.peak = heap.inUse;
+      }
+      buffer = grown;
+      capacity = size;
+      return true;
+    }
+    void release() {
+      if (buffer != NULL) {
+        hostHeap().inUse -= capacity + 1 + HOST_HEAP_BLOCK_OVERHEAD;
+        free(buffer);
+      }
+      buffer = NULL;
+      capacity = 0;
+      len = 0;
+    }
+    void copy(const char *text, unsigned int length) {
+      if (reserve(length)) {
+        memcpy(buffer, text, length);
+        len = length;
+        buffer[len] = 0;
+      }
+    }
+    void concat(const char *text, unsigned int length) {
+      if (reserve(len + length)) {
+        memcpy(buffer + len, text, length);
+        len += length;
+        buffer[len] = 0;
+      }
+    }
+};
+
+// Serial. PJON's ThroughSerial wants the Stream name.
+class Stream {
+  public:
+    void begin(unsigned long) {}
+    void flush() { fflush(stdout); }
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t write(uint8_t c) { return echo("%c", c); }
+    operator bool() { return true; }
+
+    size_t print(const __FlashStringHelper *text) { return echo("%s", reinterpret_cast<const char*>(text)); }
+    size_t print(const char *text) { return echo("%s", text); }
+    size_t print(const String &text) { return echo("%s", text.c_str()); }
+    size_t print(char c) { return echo("%c", c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC) { return base == HEX ? echo("%lx", n) : echo("%ld", n); }
+    size_t print(unsigned long n, int base = DEC) { return base == HEX ? echo("%lx", n) : echo("%lu", n); }
+    size_t print(double n, int digits = 2) { return echo("%.*f", digits, n); }
+
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+    size_t println() { return echo("\n"); }
+
+  private:
+    template <typename... Args> size_t echo(const char *format, Args... args) {
+      return hostSerialEcho ? printf(format, args...) : 0;
+    }
+};
+
+extern Stream Serial;
+
+#endif
@@ -0,0 +1,139 @@
+// One simulated node of CommBenchmark. There is no include guard on purpose: CommBenchmark.cpp
+// includes this once per node with BENCH_NODE set to a new namespace name, and each copy gets its
+// own GameCommUtils.
+
+#define GAME_COMM_NAMESPACE BENCH_NODE
+#undef GameCommUtils_h
+#include <GameCommUtils.h>
+#undef GAME_COMM_NAMESPACE
+
+namespace BENCH_NODE {
+
+benchNodeStruct *self = NULL;
+uint32_t requestSentMicros[256];       // By request handle
+uint8_t pingTargetByHandle[256];
+uint8_t nextPingTarget = 0;
+
+// processReceive() stops listening while a frame is held for room in the received event queue, the
+// node does not answer then either.
+void receiveFrame() {
+  if (!readyToReceive()) {
+    return;
+  }
+  bus.receive();
+}
+
+void pingAnswered(GameRequestHandle handle, bool success) {
+  benchNodeStruct *target = findBenchNode(pingTargetByHandle[handle]);
+  if (target != NULL) {
+    target->pingOutstanding = false;
+  }
+  if (success) {
+    benchResults.pingsAnswered++;
+    benchResults.roundTrip.push_back(micros() - requestSentMicros[handle]);
+  } else {
+    benchResults.pingsFailed++;
+  }
+}
+
+// Controller side. The int is the sender's event count, so gaps and repeats show up.
+void dialPositionReceived() {
+  benchNodeStruct *from = findBenchNode(eventData.sentFrom);
+  if (from == NULL) {
+    return;
+  }
+  uint16_t number = (uint16_t)eventData.intData & BENCH_EVENT_NUMBER_MASK;
+  if (from->eventsReceived > 0 && number == from->lastEventNumber) {
+    benchResults.eventsDuplicated++;
+    return;
+  }
+  from->eventsReceived++;
+  from->lastEventNumber = number;
+  benchResults.eventsDelivered++;
+  benchResults.eventLatency.push_back(micros() - from->eventSentMicros[number % BENCH_SENT_TIMES]);
+}
+
+// The controller pings the puzzles round robin, one ping in flight per puzzle.
+void sendPings() {
+  uint32_t now = micros();
+  if ((int32_t)(now - self->nextSendMicros) < 0) {
+    return;
+  }
+  self->nextSendMicros += benchConfig.pingMicros;
+
+  for (uint8_t tries = 0; tries < benchConfig.puzzles; tries++) {
+    benchNodeStruct *target = &benchNodes[1 + nextPingTarget];
+    nextPingTarget = (nextPingTarget + 1) % benchConfig.puzzles;
+    if (target->pingOutstanding) {
+      continue;
+    }
+    GameRequestHandle handle = sendGameRequest<PingEvent>(target->nodeId, pingAnswered);
+    if (handle == NO_GAME_REQUEST) {
+      benchResults.pingsNotSent++;
+    } else {
+      benchResults.pingsSent++;
+      target->pingOutstanding = true;
+      requestSentMicros[handle] = now;
+      pingTargetByHandle[handle] = target->nodeId;
+    }
+    return;
+  }
+}
+
+void sendEvents() {
+  uint32_t now = micros();
+  if ((int32_t)(now - self->nextSendMicros) < 0) {
+    return;
+  }
+  self->nextSendMicros += benchConfig.eventMicros;
+  uint16_t number = self->eventsSent & BENCH_EVENT_NUMBER_MASK;
+  self->eventSentMicros[number % BENCH_SENT_TIMES] = now;
+  self->eventsSent++;
+  benchResults.eventsSent++;
+  sendIntEventToNode(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, number);
+}
+
+void loop() {
+  if (self->nodeId == GAME_CONTROLLER_NODE) {
+    if (benchConfig.pingMicros > 0) {
+      sendPings();
+    }
+  } else if (benchConfig.eventMicros > 0) {
+    sendEvents();
+  }
+  delayMicroseconds(benchConfig.gameLoopMicros);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  doComm();
+  self->hostNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  self->passes++;
+}
+
+void setup(benchNodeStruct *node) {
+  self = node;
+  initCommunications(node->nodeId);
+  if (node->nodeId == GAME_CONTROLLER_NODE) {
+    onEvent(CE_DIAL_POSITION, dialPositionReceived);
+  }
+  // Spread the first sends out over one interval
+  node->nextSendMicros = micros() + random(0, 1 + (node->nodeId == GAME_CONTROLLER_NODE ?
+                                                   benchConfig.pingMicros : benchConfig.eventMicros));
+  attachInProcessNode(bus.strategy, loop, receiveFrame);
+}
+
+void collectStats() {
+  for (uint8_t i = 0; i < MAX_COMM_STATS_NODES; i++) {
+    benchResults.framesSent += commStats[i].framesSent;
+    benchResults.attempts += commStats[i].attempts;
+    benchResults.naks += commStats[i].naks;
+    benchResults.connectionLost += commStats[i].connectionLost;
+    benchResults.bufferFull += commStats[i].bufferFull;
+    benchResults.expired += commStats[i].expired;
+    benchResults.eventsDropped += commStats[i].eventsDropped;
+  }
+  benchResults.duplicatesSuppressed += duplicatesSuppressed;
+}
+
+}
+
+#undef BENCH_NODE
@@ -0,0 +1,231 @@
+// Comm benchmark. Runs GameCommUtils for a controller and a number of puzzle nodes in one process,
+// over the in process bus, and reports round trip latency, event throughput and losses.
+//
+// The controller pings the puzzles round robin with sendGameRequest<PingEvent>() and times the
+// PONGs. Every puzzle sends the controller a CE_DIAL_POSITION event at a fixed rate. All times are
+// simulated bus time except the doComm() cost, which is measured on the host.
+//
+//   make && ./CommBenchmark -n 4 -s 60 -p 250 -e 100 -l 2
+//
+// Comm settings are compile time, like on the nodes: make CONFIG="-DSWBB_MAX_ATTEMPTS=20"
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <getopt.h>
+#include "PJONNames.h"
+
+#define GAME_COMM_STRATEGY_HEADER <InProcessBus.h>
+#define GAME_COMM_STRATEGY InProcessBus
+
+// The controller talks to every puzzle
+#define BENCH_MAX_PUZZLES 8
+#ifndef MAX_OUTBOUND_DESTINATIONS
+#define MAX_OUTBOUND_DESTINATIONS BENCH_MAX_PUZZLES
+#endif
+#ifndef OUTBOUND_QUEUE_SLOTS
+#define OUTBOUND_QUEUE_SLOTS 6
+#endif
+#ifndef MAX_COMM_STATS_NODES
+#define MAX_COMM_STATS_NODES BENCH_MAX_PUZZLES
+#endif
+
+uint32_t hostMicros = 0;
+bool hostSerialEcho = false;
+Stream Serial;
+
+#define BENCH_EVENT_NUMBER_MASK 0x7FFF
+#define BENCH_SENT_TIMES 256             // Send times kept per puzzle, for the event latency
+
+struct benchConfigStruct {
+  uint8_t puzzles = 4;
+  uint32_t seconds = 60;
+  uint32_t pingMicros = 250000;          // Between two pings from the controller, 0 for none
+  uint32_t eventMicros = 100000;         // Between two events from each puzzle, 0 for none
+  uint32_t gameLoopMicros = 0;           // Game work per loop() pass, besides doComm()
+  uint8_t lossPercent = 0;
+  unsigned int seed = 1;
+};
+
+struct benchNodeStruct {
+  uint8_t nodeId = 0;
+  uint32_t nextSendMicros = 0;
+  bool pingOutstanding = false;
+  uint32_t eventsSent = 0;
+  uint32_t eventsReceived = 0;           // By the controller
+  uint16_t lastEventNumber = 0;
+  uint32_t eventSentMicros[BENCH_SENT_TIMES];
+  uint64_t hostNanos = 0;                // Host time spent in doComm()
+  uint32_t passes = 0;
+};
+
+struct benchResultsStruct {
+  uint32_t pingsSent = 0;
+  uint32_t pingsAnswered = 0;
+  uint32_t pingsFailed = 0;
+  uint32_t pingsNotSent = 0;             // No free request slot
+  uint32_t eventsSent = 0;
+  uint32_t eventsDelivered = 0;
+  uint32_t eventsDuplicated = 0;
+  std::vector<uint32_t> roundTrip;       // Microseconds
+  std::vector<uint32_t> eventLatency;
+
+  // Comm stats of every node, added up
+  uint32_t framesSent = 0;
+  uint32_t attempts = 0;
+  uint32_t naks = 0;
+  uint32_t connectionLost = 0;
+  uint32_t bufferFull = 0;
+  uint32_t expired = 0;
+  uint32_t eventsDropped = 0;            // Received event queue full
+  uint32_t duplicatesSuppressed = 0;
+};
+
+benchConfigStruct benchConfig;
+benchNodeStruct benchNodes[1 + BENCH_MAX_PUZZLES];
+benchResultsStruct benchResults;
+
+benchNodeStruct *findBenchNode(uint8_t nodeId) {
+  for (uint8_t i = 0; i <= benchConfig.puzzles; i++) {
+    if (benchNodes[i].nodeId == nodeId) {
+      return &benchNodes[i];
+    }
+  }
+  return NULL;
+}
+
+#define BENCH_NODE controllerNode
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode1
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode2
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode3
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode4
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode5
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode6
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode7
+#include "BenchNode.h"
+#define BENCH_NODE puzzleNode8
+#include "BenchNode.h"
+
+const uint8_t puzzleNodeIds[BENCH_MAX_PUZZLES] = {
+  MP3_PLAYER_NODE, DOOR_KNOCKER_NODE, MASTER_MIND_POT_GAME_NODE, FISH_SORTING_GAME_NODE,
+  DOCK_PLANKS_GAME_NODE, LICENSE_PLATE_GAME_NODE, HELP_RADIO_NODE, SHIP_WHEEL_LOCK_NODE
+};
+
+void (*const nodeSetups[1 + BENCH_MAX_PUZZLES])(benchNodeStruct *) = {
+  controllerNode::setup, puzzleNode1::setup, puzzleNode2::setup, puzzleNode3::setup, puzzleNode4::setup,
+  puzzleNode5::setup, puzzleNode6::setup, puzzleNode7::setup, puzzleNode8::setup
+};
+
+void (*const nodeCollectStats[1 + BENCH_MAX_PUZZLES])() = {
+  controllerNode::collectStats, puzzleNode1::collectStats, puzzleNode2::collectStats, puzzleNode3::collectStats,
+  puzzleNode4::collectStats, puzzleNode5::collectStats, puzzleNode6::collectStats, puzzleNode7::collectStats,
+  puzzleNode8::collectStats
+};
+
+void printLatency(const char *label, std::vector<uint32_t> &samples) {
+  printf("%-14s", label);
+  if (samples.empty()) {
+    printf("no samples\n");
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  uint64_t total = 0;
+  for (uint32_t sample : samples) {
+    total += sample;
+  }
+  printf("ms min %.1f  avg %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+         samples.front() / 1000.0, total / 1000.0 / samples.size(), samples[samples.size() / 2] / 1000.0,
+         samples[samples.size() * 99 / 100] / 1000.0, samples.back() / 1000.0);
+}
+
+void printResults(double wallSeconds) {
+  benchResultsStruct &r = benchResults;
+  uint32_t simMicros = benchConfig.seconds * 1000000;
+
+  printf("1 controller + %u puzzles, %u s, ", benchConfig.puzzles, benchConfig.seconds);
+  printf("ping every %.1f ms, event every %.1f ms per puzzle, %u%% frames lost on the wire\n\n",
+         benchConfig.pingMicros / 1000.0, benchConfig.eventMicros / 1000.0, benchConfig.lossPercent);
+
+  printf("Round trip    sent %u  answered %u  failed %u  no request slot %u\n",
+         r.pingsSent, r.pingsAnswered, r.pingsFailed, r.pingsNotSent);
+  printLatency("", r.roundTrip);
+  printf("Events        sent %u  delivered %u  lost %u  duplicates %u  (%.1f per s delivered)\n",
+         r.eventsSent, r.eventsDelivered, r.eventsSent - r.eventsDelivered, r.eventsDuplicated,
+         r.eventsDelivered / (double)benchConfig.seconds);
+  printLatency("", r.eventLatency);
+  printf("Wire          frames %u  bytes %u  busy %.1f%%  lost %u  found busy %u\n",
+         inProcessMedium.frames, inProcessMedium.bytes, 100.0 * inProcessMedium.airMicros / simMicros,
+         inProcessMedium.framesLost, inProcessMedium.busyStarts);
+  printf("Comm stats    frames %u  attempts %u  naks %u  lost %u  buffer full %u  expired %u  receive queue full %u"
+         "  resends dropped %u\n", r.framesSent, r.attempts, r.naks, r.connectionLost, r.bufferFull, r.expired,
+         r.eventsDropped, r.duplicatesSuppressed);
+
+  uint64_t hostNanos = 0;
+  uint64_t passes = 0;
+  for (uint8_t i = 0; i <= benchConfig.puzzles; i++) {
+    hostNanos += benchNodes[i].hostNanos;
+    passes += benchNodes[i].passes;
+  }
+  printf("Host          %.0f ns per doComm() pass, %.2f s wall\n",
+         passes == 0 ? 0.0 : (double)hostNanos / passes, wallSeconds);
+}
+
+void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [-n puzzles] [-s seconds] [-p ping ms] [-e event ms] [-g game loop us] [-l loss %%] [-r seed] [-v]\n"
+          "  -n  Puzzle nodes, 1 to %d (4)\n"
+          "  -s  Simulated seconds (60)\n"
+          "  -p  Time between controller pings, 0 for none (250)\n"
+          "  -e  Time between events from each puzzle, 0 for none (100)\n"
+          "  -g  Game work in every loop() pass, microseconds (0)\n"
+          "  -l  Percent of frames lost on the wire (0)\n"
+          "  -r  Random seed (1)\n"
+          "  -v  Show the nodes' Serial output\n",
+          name, BENCH_MAX_PUZZLES);
+}
+
+int main(int argc, char **argv) {
+  int option;
+  while ((option = getopt(argc, argv, "n:s:p:e:g:l:r:vh")) != -1) {
+    switch (option) {
+      case 'n': benchConfig.puzzles = constrain(atoi(optarg), 1, BENCH_MAX_PUZZLES); break;
+      case 's': benchConfig.seconds = constrain(atoi(optarg), 1, 3600); break;
+      case 'p': benchConfig.pingMicros = atof(optarg) * 1000; break;
+      case 'e': benchConfig.eventMicros = atof(optarg) * 1000; break;
+      case 'g': benchConfig.gameLoopMicros = atoi(optarg); break;
+      case 'l': benchConfig.lossPercent = constrain(atoi(optarg), 0, 100); break;
+      case 'r': benchConfig.seed = atoi(optarg); break;
+      case 'v': hostSerialEcho = true; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  randomSeed(benchConfig.seed);
+  inProcessMedium.lossPercent = benchConfig.lossPercent;
+
+  benchNodes[0].nodeId = GAME_CONTROLLER_NODE;
+  for (uint8_t i = 1; i <= benchConfig.puzzles; i++) {
+    benchNodes[i].nodeId = puzzleNodeIds[i - 1];
+  }
+  for (uint8_t i = 0; i <= benchConfig.puzzles; i++) {
+    hostMicros = 0;
+    nodeSetups[i](&benchNodes[i]);
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  runInProcessBus(benchConfig.seconds * 1000000);
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (uint8_t i = 0; i <= benchConfig.puzzles; i++) {
+    nodeCollectStats[i]();
+  }
+  printResults(wallSeconds);
+  return 0;
+}
@@ -0,0 +1,131 @@
+// CRC benchmark. Checks that every CRC8 and CRC32 implementation in PJON's utils gives the same
+// CRCs as the bitwise one, then times each of them on PJON sized packets and on a long buffer.
+//
+//   make CrcBenchmark && ./CrcBenchmark
+//
+// Cycles per byte are read from the time stamp counter on x86, elsewhere only ns per byte is shown.
+
+#include <Arduino.h>
+#include <PJONDefines.h>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CRC_BENCH_CYCLES 1
+#endif
+
+uint32_t hostMicros = 0;
+bool hostSerialEcho = false;
+Stream Serial;
+
+typedef uint8_t (*crc8Function)(const uint8_t *, uint16_t, uint8_t);
+typedef uint32_t (*crc32Function)(const uint8_t *, uint16_t, uint32_t);
+
+struct crcVariant {
+  const char *name;
+  crc8Function crc8;
+  crc32Function crc32;
+};
+
+const crcVariant variants[] = {
+  { "bitwise",    crc8::compute_bitwise,    crc32::compute_bitwise },
+  { "table",      crc8::compute_table,      crc32::compute_table },
+  { "slice by 4", crc8::compute_slice_by_4, crc32::compute_slice_by_4 },
+  { "slice by 8", crc8::compute_slice_by_8, crc32::compute_slice_by_8 }
+};
+const uint8_t numVariants = sizeof(variants) / sizeof(variants[0]);
+
+volatile uint32_t crcSink;    // Keeps the timed calls from being optimized away
+
+bool checkVariants(const std::vector<uint8_t> &data) {
+  for (uint32_t run = 0; run < 20000; run++) {
+    uint16_t offset = rand() % 64;
+    uint16_t length = rand() % (data.size() - offset);
+    uint8_t seed8 = rand();
+    uint32_t seed32 = ((uint32_t)rand() << 16) ^ rand();
+    uint8_t expected8 = crc8::compute_bitwise(&data[offset], length, seed8);
+    uint32_t expected32 = crc32::compute_bitwise(&data[offset], length, seed32);
+    for (uint8_t v = 1; v < numVariants; v++) {
+      if (variants[v].crc8(&data[offset], length, seed8) != expected8 ||
+          variants[v].crc32(&data[offset], length, seed32) != expected32) {
+        printf("%s differs from bitwise, offset %u length %u\n", variants[v].name, offset, length);
+        return false;
+      }
+    }
+  }
+  // The compute() in use, as PJON calls it
+  if (crc8::compute(&data[0], 50) != crc8::compute_bitwise(&data[0], 50) ||
+      crc32::compute(&data[0], 50) != crc32::compute_bitwise(&data[0], 50)) {
+    printf("compute() differs from bitwise\n");
+    return false;
+  }
+  return true;
+}
+
+template <typename Function, typename Result>
+void timeVariant(Function function, const std::vector<uint8_t> &data, uint16_t length, double &nsPerByte,
+                 double &cyclesPerByte) {
+  uint32_t calls = 0;
+  uint32_t totalBytes = 0;
+  uint64_t cycles = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point end = start;
+  while (totalBytes < 64u * 1024 * 1024 && end - start < std::chrono::milliseconds(200)) {
+#ifdef CRC_BENCH_CYCLES
+    uint64_t cyclesStart = __rdtsc();
+#endif
+    for (uint16_t offset = 0; offset + length <= data.size(); offset += length) {
+      crcSink = (Result)function(&data[offset], length, (Result)calls);
+      calls++;
+      totalBytes += length;
+    }
+#ifdef CRC_BENCH_CYCLES
+    cycles += __rdtsc() - cyclesStart;
+#endif
+    end = std::chrono::steady_clock::now();
+  }
+  nsPerByte = std::chrono::duration<double, std::nano>(end - start).count() / totalBytes;
+  cyclesPerByte = (double)cycles / totalBytes;
+}
+
+int main() {
+  std::vector<uint8_t> data(16 * 1024);
+  for (uint32_t i = 0; i < data.size(); i++) {
+    data[i] = rand();
+  }
+  if (!checkVariants(data)) {
+    return 1;
+  }
+  printf("All variants match bitwise. PJON_CRC_MODE is %d.\n\n", PJON_CRC_MODE);
+
+  const uint16_t lengths[] = { 10, 50, 4096 };
+#ifdef CRC_BENCH_CYCLES
+  printf("%-12s %8s %18s %18s %18s\n", "", "", "10 B", "50 B", "4096 B");
+  const char *unit = "cycles/B  ns/B";
+#else
+  printf("%-12s %8s %10s %10s %10s\n", "", "", "10 B", "50 B", "4096 B");
+  const char *unit = "ns/B";
+#endif
+  printf("(%s)\n", unit);
+  for (uint8_t crc = 0; crc < 2; crc++) {
+    for (uint8_t v = 0; v < numVariants; v++) {
+      printf("%-12s %8s", variants[v].name, crc == 0 ? "CRC8" : "CRC32");
+      for (uint16_t length : lengths) {
+        double ns;
+        double cycles;
+        if (crc == 0) {
+          timeVariant<crc8Function, uint8_t>(variants[v].crc8, data, length, ns, cycles);
+        } else {
+          timeVariant<crc32Function, uint32_t>(variants[v].crc32, data, length, ns, cycles);
+        }
+#ifdef CRC_BENCH_CYCLES
+        printf("   %7.2f %7.2f", cycles, ns);
+#else
+        printf(" %10.2f", ns);
+#endif
+      }
+      printf("\n");
+    }
+  }
+  return 0;
+}
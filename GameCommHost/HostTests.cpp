@@ -0,0 +1,930 @@
+// Host tests. Each test sets up what it needs on the simulated clock, checks the outcome and
+// prints ok or FAIL. The exit code is the number of failed checks.
+//
+//   make test
+//
+// The comm tests run GameCommUtils nodes on the in process bus, like CommBenchmark. Every test has
+// nodes of its own, declared next to it with TestNode.h, and puts them on an empty wire.
+
+#include <Arduino.h>
+#include <GameScheduler.h>
+#include "PJONNames.h"
+
+#define GAME_COMM_STRATEGY_HEADER <InProcessBus.h>
+#define GAME_COMM_STRATEGY InProcessBus
+
+// For the PJON tests of the per receiver chains. The comm tests run the same with it: GameCommUtils
+// keeps at most one packet in flight to a node but for control events.
+#define ORDERED_SENDING true
+
+uint32_t hostMicros = 0;
+bool hostSerialEcho = false;
+Stream Serial;
+
+int failedChecks = 0;
+
+#define CHECK(condition) checkThat((condition), #condition, __FILE__, __LINE__)
+
+bool checkThat(bool condition, const char *text, const char *file, int line) {
+  if (!condition) {
+    printf("  %s:%d: check failed: %s\n", file, line, text);
+    failedChecks++;
+  }
+  return condition;
+}
+
+void runTest(const char *name, void (*test)()) {
+  int failedBefore = failedChecks;
+  test();
+  printf("%-48s %s\n", name, failedChecks == failedBefore ? "ok" : "FAIL");
+}
+
+// ----------------------------------------------------------------------------------------------
+// GameScheduler
+
+uint16_t tickerRuns = 0;
+
+void ticker(int arg) {
+  tickerRuns++;
+}
+
+void blockInPlace(int millis) {
+  delay(millis);
+}
+
+void waitWithScheduler(int millis) {
+  runSchedulerFor(millis);
+}
+
+void clearScheduler() {
+  for (uint8_t i = 0; i < MAX_SCHEDULED_TASKS; i++) {
+    cancelTask(scheduledTasks[i].handle);
+  }
+  tickerRuns = 0;
+}
+
+// Run the scheduler for one simulated second with a 20 ms ticker, and blocker(arg) once after 100 ms
+void runTickerWith(GameTaskCallback blocker, int arg) {
+  clearScheduler();
+  schedulePeriodic(20, ticker);
+  if (blocker != NULL) {
+    scheduleAfter(100, blocker, arg);
+  }
+  schedulerMaxLateMillis = 0;
+  unsigned long start = millis();
+  while (millis() - start < 1000) {
+    runScheduler();
+  }
+}
+
+void testSchedulerOnTime() {
+  runTickerWith(NULL, 0);
+  CHECK(schedulerMaxLateMillis <= 1);
+  CHECK(tickerRuns >= 49 && tickerRuns <= 50);
+}
+
+void testSchedulerBlockingCallback() {
+  runTickerWith(blockInPlace, 200);
+  // The ticker came due while the callback sat in delay() and ran once it returned
+  CHECK(schedulerMaxLateMillis >= 180 && schedulerMaxLateMillis <= 201);
+  // The missed runs are skipped, not made up back to back
+  CHECK(tickerRuns < 45);
+}
+
+void testSchedulerWaitingCallback() {
+  runTickerWith(waitWithScheduler, 200);
+  CHECK(schedulerMaxLateMillis <= 1);
+  CHECK(tickerRuns >= 49 && tickerRuns <= 50);
+}
+
+// ----------------------------------------------------------------------------------------------
+// GameCommUtils
+
+#define TEST_NODE lostController
+#include "TestNode.h"
+#define TEST_NODE lostPuzzle
+#include "TestNode.h"
+#define TEST_NODE expiryController
+#include "TestNode.h"
+#define TEST_NODE repliesController
+#include "TestNode.h"
+#define TEST_NODE repliesPuzzle
+#include "TestNode.h"
+#define TEST_NODE rebootController
+#include "TestNode.h"
+#define TEST_NODE rebootControllerRestarted
+#include "TestNode.h"
+#define TEST_NODE rebootPuzzle
+#include "TestNode.h"
+#define TEST_NODE windowSenderA
+#include "TestNode.h"
+#define TEST_NODE windowSenderB
+#include "TestNode.h"
+#define TEST_NODE windowSenderC
+#include "TestNode.h"
+#define TEST_NODE windowPuzzle
+#include "TestNode.h"
+#define TEST_NODE queueController
+#include "TestNode.h"
+#define TEST_NODE queuePuzzle
+#include "TestNode.h"
+#define TEST_NODE isrController
+#include "TestNode.h"
+#define TEST_NODE isrPuzzle
+#include "TestNode.h"
+#define GAME_COMM_SEND_LEGACY_FRAMES
+#define TEST_NODE legacyController
+#include "TestNode.h"
+#undef GAME_COMM_SEND_LEGACY_FRAMES
+#define TEST_NODE legacyPuzzle
+#include "TestNode.h"
+
+// Take every node off the wire
+void clearInProcessBus() {
+  inProcessMedium = inProcessMediumStruct();
+}
+
+// Run the nodes on the wire for seconds of simulated time
+void runNodesFor(uint32_t seconds) {
+  uint32_t start = hostMicros;
+  for (uint8_t i = 0; i < inProcessMedium.numNodes; i++) {
+    if ((int32_t)(inProcessMedium.nodes[i].clock - start) > 0) {
+      start = inProcessMedium.nodes[i].clock;
+    }
+  }
+  runInProcessBus(start + seconds * 1000000);
+}
+
+void sendStartToLivePuzzleAndMissingNode() {
+  lostController::sendEventToNode(MASTER_MIND_POT_GAME_NODE, CE_START_PUZZLE);
+  lostController::sendEventToNode(DOCK_PLANKS_GAME_NODE, CE_START_PUZZLE);    // Not on the wire
+}
+
+// PJON reports a lost connection with the device id, which is what the stats are kept by
+void testConnectionLostCounted() {
+  clearInProcessBus();
+  lostController::setup(GAME_CONTROLLER_NODE);
+  lostPuzzle::setup(MASTER_MIND_POT_GAME_NODE);
+
+  lostController::nextStep = sendStartToLivePuzzleAndMissingNode;
+  runNodesFor(600);
+
+  lostController::commStatsStruct *live = lostController::findCommStats(MASTER_MIND_POT_GAME_NODE);
+  lostController::commStatsStruct *gone = lostController::findCommStats(DOCK_PLANKS_GAME_NODE);
+  CHECK(live->framesSent == 1 && live->connectionLost == 0);
+  CHECK(gone->framesSent == 1 && gone->connectionLost == 1);
+  CHECK(gone->attempts > SWBB_MAX_ATTEMPTS);
+}
+
+// GameCommUtils' PJON settings reach the vendored PJON, which reads them without the PJON_ prefix
+void testPjonSettingsApplied() {
+  clearInProcessBus();
+  lostController::setup(GAME_CONTROLLER_NODE);
+  CHECK(sizeof(lostController::bus.packets) / sizeof(lostController::bus.packets[0]) == 7);
+  CHECK(PJON_MAX_PACKETS == MAX_PACKETS);
+  CHECK(INCLUDE_ASYNC_ACK && PJON_INCLUDE_ASYNC_ACK);
+  CHECK(lostController::bus.config & ACK_MODE_BIT);
+}
+
+void sendToMissingNodesWithExpiry() {
+  const expiryController::GamePriority audio = expiryController::GAME_PRIORITY_AUDIO;
+  expiryController::sendEventToNode(DOCK_PLANKS_GAME_NODE, CE_PLAY_TRACK, "a", audio, 500);
+  expiryController::sendEventToNode(FISH_SORTING_GAME_NODE, CE_PLAY_TRACK, "b", audio, 1500);
+  expiryController::sendEventToNode(DOOR_KNOCKER_NODE, CE_PLAY_TRACK, "c", audio, GAME_NEVER_EXPIRE);
+}
+
+// Packets nobody answers are removed when they expire, each at its own time, and counted as expired
+// rather than lost. Every attempt before is counted.
+void testExpiredPacketsCounted() {
+  clearInProcessBus();
+  expiryController::setup(GAME_CONTROLLER_NODE);
+  expiryController::nextStep = sendToMissingNodesWithExpiry;
+  expiryController::commStatsStruct *dock = expiryController::findCommStats(DOCK_PLANKS_GAME_NODE);
+  expiryController::commStatsStruct *fish = expiryController::findCommStats(FISH_SORTING_GAME_NODE);
+  expiryController::commStatsStruct *door = expiryController::findCommStats(DOOR_KNOCKER_NODE);
+
+  runNodesFor(1);
+  CHECK(dock->framesSent == 1 && dock->expired == 1 && dock->attempts > 1);
+  CHECK(fish->framesSent == 1 && fish->expired == 0);
+  CHECK(expiryController::packetsInFlightTo(FISH_SORTING_GAME_NODE) == 1);
+
+  runNodesFor(1);
+  CHECK(fish->expired == 1 && fish->connectionLost == 0 && fish->attempts > dock->attempts);
+  CHECK(expiryController::packetsInFlightTo(FISH_SORTING_GAME_NODE) == 0);
+  CHECK(door->expired == 0 && expiryController::packetsInFlightTo(DOOR_KNOCKER_NODE) == 1);
+  CHECK(!expiryController::busPacketsExpire);
+}
+
+uint8_t startRequestsFinished = 0;
+uint8_t startSuccessesHandled = 0;
+
+void startRequestFinished(repliesController::GameRequestHandle handle, bool success) {
+  startRequestsFinished++;
+}
+
+void startSuccessHandled() {
+  startSuccessesHandled++;
+}
+
+void sendStartRequest() {
+  repliesController::onEvent(CE_PUZZLE_START_SUCCESS, startSuccessHandled);
+  repliesController::sendGameRequest<repliesController::StartPuzzleEvent>(MASTER_MIND_POT_GAME_NODE, startRequestFinished);
+}
+
+// The puzzle answers the start twice, as it would if the answer to a resend was late
+void answerStartTwice() {
+  repliesPuzzle::sendPuzzleStartSuccess();
+  repliesPuzzle::sendPuzzleStartSuccess();
+}
+
+void registerAnswerStartTwice() {
+  repliesPuzzle::onEvent(CE_START_PUZZLE, answerStartTwice);
+}
+
+// A response that matches no pending request is dropped, not handed to the game
+void testUnmatchedResponseDropped() {
+  clearInProcessBus();
+  repliesController::setup(GAME_CONTROLLER_NODE);
+  repliesPuzzle::setup(MASTER_MIND_POT_GAME_NODE);
+
+  repliesPuzzle::nextStep = registerAnswerStartTwice;
+  repliesController::nextStep = sendStartRequest;
+  runNodesFor(10);
+
+  CHECK(startRequestsFinished == 1);
+  CHECK(startSuccessesHandled == 0);
+}
+
+uint8_t startsHandled = 0;
+uint8_t startsAnswered = 0;
+
+void countStart() {
+  startsHandled++;
+  rebootPuzzle::sendPuzzleStartSuccess();
+}
+
+void registerCountStart() {
+  rebootPuzzle::onEvent(CE_START_PUZZLE, countStart);
+}
+
+void startAnswered(rebootController::GameRequestHandle handle, bool success) {
+  if (success) {
+    startsAnswered++;
+  }
+}
+
+void sendStartBeforeRestart() {
+  rebootController::sendGameRequest<rebootController::StartPuzzleEvent>(MASTER_MIND_POT_GAME_NODE, startAnswered);
+}
+
+void sendStartAfterRestart() {
+  rebootControllerRestarted::sendGameRequest<rebootControllerRestarted::StartPuzzleEvent>(MASTER_MIND_POT_GAME_NODE,
+                                                                                           startAnswered);
+}
+
+// A sender that restarts numbers its requests from 1 again. Its first request after the restart is
+// new to the receiver, even though the receiver saw a request numbered 1 from it moments ago.
+void testRestartedSenderNotDuplicate() {
+  clearInProcessBus();
+  rebootController::setup(GAME_CONTROLLER_NODE);
+  rebootPuzzle::setup(MASTER_MIND_POT_GAME_NODE);
+
+  rebootPuzzle::nextStep = registerCountStart;
+  rebootController::nextStep = sendStartBeforeRestart;
+  runNodesFor(5);
+  CHECK(startsHandled == 1 && startsAnswered == 1);
+
+  rebootControllerRestarted::restart(GAME_CONTROLLER_NODE, 0);
+  rebootControllerRestarted::nextStep = sendStartAfterRestart;
+  runNodesFor(5);
+  CHECK(rebootControllerRestarted::bootEpoch != rebootController::bootEpoch);
+  CHECK(startsHandled == 2 && startsAnswered == 2);
+  CHECK(rebootPuzzle::duplicatesSuppressed == 0);
+}
+
+uint8_t unansweredStarts = 0;
+
+void countStartWithoutAnswer() {
+  unansweredStarts++;
+}
+
+void registerCountStartWithoutAnswer() {
+  windowPuzzle::onEvent(CE_START_PUZZLE, countStartWithoutAnswer);
+}
+
+void sendStartFromA() {
+  windowSenderA::sendGameRequest<windowSenderA::StartPuzzleEvent>(MASTER_MIND_POT_GAME_NODE, NULL);
+}
+
+void sendStartFromB() {
+  windowSenderB::sendGameRequest<windowSenderB::StartPuzzleEvent>(MASTER_MIND_POT_GAME_NODE, NULL);
+}
+
+void sendStartFromC() {
+  windowSenderC::sendGameRequest<windowSenderC::StartPuzzleEvent>(MASTER_MIND_POT_GAME_NODE, NULL);
+}
+
+// More senders than sequence windows. The puzzle never answers, so every sender keeps resending. A
+// window is not taken from a sender that is still resending, the extra sender's request is dropped
+// instead, and no request is handled twice.
+void testSequenceWindowsNotEvictedWhileResending() {
+  clearInProcessBus();
+  windowPuzzle::setup(MASTER_MIND_POT_GAME_NODE);
+  windowSenderA::setup(GAME_CONTROLLER_NODE);
+  windowSenderB::setup(DOOR_KNOCKER_NODE);
+  windowSenderC::setup(FISH_SORTING_GAME_NODE);
+
+  windowPuzzle::nextStep = registerCountStartWithoutAnswer;
+  windowSenderA::nextStep = sendStartFromA;
+  windowSenderB::nextStep = sendStartFromB;
+  windowSenderC::nextStep = sendStartFromC;
+  runNodesFor(20);
+
+  CHECK(MAX_SEQUENCE_SENDERS == 2);
+  CHECK(unansweredStarts == 2);
+  CHECK(windowPuzzle::duplicatesSuppressed == 2 * (REQUEST_MAX_ATTEMPTS - 1));
+  CHECK(windowPuzzle::sequenceWindowsFull == REQUEST_MAX_ATTEMPTS);
+}
+
+char tracksPlayed[8];
+uint8_t tracksPlayedCount = 0;
+
+void trackPlayed() {
+  if (tracksPlayedCount < sizeof(tracksPlayed) - 1) {
+    tracksPlayed[tracksPlayedCount++] = queuePuzzle::eventData.data[0];
+    tracksPlayed[tracksPlayedCount] = 0;
+  }
+}
+
+void busyInGameLoop() {
+  delay(100);
+}
+
+// Two frames of one event each, then a batch of four
+void sendTwoFramesAndBatch() {
+  queueController::sendEventToNode(MASTER_MIND_POT_GAME_NODE, CE_PLAY_TRACK, "1");
+  queueController::flushBatch();
+  queueController::sendEventToNode(MASTER_MIND_POT_GAME_NODE, CE_PLAY_TRACK, "2");
+  queueController::flushBatch();
+  for (char track = '3'; track <= '6'; track++) {
+    char data[2] = {track, 0};
+    queueController::sendEventToNode(MASTER_MIND_POT_GAME_NODE, CE_PLAY_TRACK, data);
+  }
+}
+
+// A node busy in its game loop keeps receiving while frames queue up. Single event frames go in while
+// the queue has room for them, and a batch that does not fit is held until it does. Every frame is
+// taken the first time it goes out and the events are handled in order.
+void testQueuedFramesDoNotStopReceiving() {
+  clearInProcessBus();
+  queuePuzzle::setup(MASTER_MIND_POT_GAME_NODE);
+  queuePuzzle::onEvent(CE_PLAY_TRACK, trackPlayed);
+  queueController::setup(GAME_CONTROLLER_NODE);
+  // An asynchronous ack would go out on the busy puzzle's clock, and the controller's next frame only
+  // after it. With the synchronous ack alone the frames reach the puzzle while it is busy.
+  queueController::bus.set_asynchronous_acknowledge(false);
+  tracksPlayedCount = 0;
+  tracksPlayed[0] = 0;
+
+  queuePuzzle::nextStep = busyInGameLoop;
+  queueController::nextStep = sendTwoFramesAndBatch;
+  runNodesFor(1);
+
+  queueController::commStatsStruct *stats = queueController::findCommStats(MASTER_MIND_POT_GAME_NODE);
+  CHECK(strcmp(tracksPlayed, "123456") == 0);
+  // Each frame went on the wire once
+  CHECK(stats->framesSent == 3 && inProcessMedium.frames == 3);
+  CHECK(queuePuzzle::receivedEventsDropped == 0);
+  CHECK(queuePuzzle::readyToReceive());
+}
+
+#define MAX_DIAL_POSITIONS 400
+int dialPositions[MAX_DIAL_POSITIONS];
+uint16_t dialPositionCount = 0;
+
+void dialPositionReceived() {
+  const int *position = isrController::gameEventPayload<isrController::DialPositionEvent>(isrController::eventData);
+  if (position != NULL && dialPositionCount < MAX_DIAL_POSITIONS) {
+    dialPositions[dialPositionCount++] = *position;
+  }
+}
+
+void setUpIsrNodes() {
+  clearInProcessBus();
+  isrController::setup(GAME_CONTROLLER_NODE);
+  isrController::onEvent(CE_DIAL_POSITION, dialPositionReceived);
+  isrPuzzle::setup(SHIP_WHEEL_LOCK_NODE);
+  dialPositionCount = 0;
+}
+
+// Events queued from an ISR arrive in order, also once the one byte queue indexes wrap around, and a
+// full queue drops the newest events and counts them
+void testIsrQueueWrapsAndOverflows() {
+  setUpIsrNodes();
+
+  for (int i = 0; i < ISR_EVENT_QUEUE_SLOTS; i++) {
+    CHECK(isrPuzzle::queueEventFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, i));
+  }
+  CHECK(!isrPuzzle::queueEventFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, 100));
+  CHECK(!isrPuzzle::queueEventFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, 101));
+  CHECK(isrPuzzle::isrEventsDropped == 2);
+  runNodesFor(1);
+  CHECK(dialPositionCount == ISR_EVENT_QUEUE_SLOTS);
+
+  // 300 events through the queue take its indexes past 255
+  int next = ISR_EVENT_QUEUE_SLOTS;
+  while (next < 300 + ISR_EVENT_QUEUE_SLOTS) {
+    for (uint8_t i = 0; i < ISR_EVENT_QUEUE_SLOTS - 1; i++, next++) {
+      isrPuzzle::queueEventFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, next);
+    }
+    runNodesFor(1);
+  }
+  CHECK(isrPuzzle::isrEventsDropped == 2);
+  CHECK(isrPuzzle::isrEventHead == isrPuzzle::isrEventTail);
+  CHECK(dialPositionCount == next);
+  bool inOrder = true;
+  for (uint16_t i = 0; i < dialPositionCount; i++) {
+    inOrder = inOrder && dialPositions[i] == i;
+  }
+  CHECK(inOrder);
+}
+
+// Values set with setLatestFromISR() between two doComm() passes go out as one event with the last one
+void testIsrLatestCoalesces() {
+  setUpIsrNodes();
+
+  for (int position = 10; position < 15; position++) {
+    CHECK(isrPuzzle::setLatestFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, position));
+  }
+  runNodesFor(1);
+  CHECK(dialPositionCount == 1 && dialPositions[0] == 14);
+
+  // Nothing new, nothing sent
+  runNodesFor(1);
+  CHECK(dialPositionCount == 1);
+
+  isrPuzzle::setLatestFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, 20);
+  runNodesFor(1);
+  CHECK(dialPositionCount == 2 && dialPositions[1] == 20);
+
+  // Every slot holds another event
+  uint8_t droppedBefore = isrPuzzle::isrEventsDropped;
+  for (uint8_t i = 1; i < ISR_LATEST_SLOTS; i++) {
+    CHECK(isrPuzzle::setLatestFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION + i, 0));
+  }
+  CHECK(!isrPuzzle::setLatestFromISR(MP3_PLAYER_NODE, CE_DIAL_POSITION, 0));
+  CHECK((uint8_t)(isrPuzzle::isrEventsDropped - droppedBefore) == 1);
+}
+
+uint8_t completionsAnswered = 0;
+uint8_t resetAndStartsHandled = 0;
+bool completionSentWithOldId = false;
+
+void completionAnswered(legacyPuzzle::GameRequestHandle handle, bool success) {
+  if (success) {
+    completionsAnswered++;
+  }
+}
+
+void answerCompletion() {
+  legacyController::replyGameEvent<legacyController::PuzzleCompletedSuccessEvent>();
+  completionSentWithOldId = memcmp(legacyController::sendBuffer, "^62", 3) == 0;
+}
+
+void countResetAndStart() {
+  resetAndStartsHandled++;
+}
+
+void registerLegacyControllerHandlers() {
+  legacyController::onEvent(CE_PUZZLE_COMPLETED, answerCompletion);
+  legacyController::onEvent(CE_RESET_AND_START_SUCCESS, countResetAndStart);
+}
+
+void sendCompletionAndResetAndStartSuccess() {
+  legacyPuzzle::sendGameRequest<legacyPuzzle::PuzzleCompletedEvent>(GAME_CONTROLLER_NODE, MASTER_MIND_POT_GAME_NODE,
+                                                                    completionAnswered);
+  legacyPuzzle::sendGameEvent<legacyPuzzle::ResetAndStartSuccessEvent>(GAME_CONTROLLER_NODE);
+}
+
+// A controller sending legacy frames answers a completion with its old id, 62, which the puzzle takes as
+// CE_PUZZLE_COMPLETED_SUCCESS. The controller still takes 62 from a puzzle as CE_RESET_AND_START_SUCCESS.
+void testOldCompletionIdAccepted() {
+  clearInProcessBus();
+  legacyController::setup(GAME_CONTROLLER_NODE);
+  legacyPuzzle::setup(MASTER_MIND_POT_GAME_NODE);
+
+  legacyController::nextStep = registerLegacyControllerHandlers;
+  legacyPuzzle::nextStep = sendCompletionAndResetAndStartSuccess;
+  runNodesFor(5);
+
+  CHECK(completionSentWithOldId);
+  CHECK(completionsAnswered == 1);
+  CHECK(resetAndStartsHandled == 1);
+}
+
+// ----------------------------------------------------------------------------------------------
+// PJON
+//
+// These tests drive a PJON of their own through a strategy that stands in for the wire.
+
+// Hands PJON the bytes in replayFrame and keeps the response it sends back
+uint8_t replayFrame[PACKET_MAX_LENGTH];
+uint16_t replayLength = 0;
+uint16_t replayPosition = 0;
+uint8_t replayResponse = 0;
+
+struct ReplayBus {
+  bool begin(uint8_t = 0) { return true; }
+  bool can_start() { return true; }
+  uint8_t get_max_attempts() { return 10; }
+  uint32_t back_off(uint8_t attempts) { return attempts; }
+  void handle_collision() {}
+  uint16_t receive_byte() { return replayPosition < replayLength ? replayFrame[replayPosition++] : FAIL; }
+  uint16_t receive_response() { return ACK; }
+  void send_response(uint8_t response) { replayResponse = response; }
+  void send_string(uint8_t *, uint16_t) {}
+};
+
+uint8_t replayPacketsReceived = 0;
+
+void replayReceiver(uint8_t *payload, uint16_t length, const PacketInfo &info) {
+  replayPacketsReceived++;
+}
+
+// The CRC receive() folds in byte by byte against compute() over the whole frame
+bool replayFrameCrcGood(bool crc32) {
+  if (crc32) {
+    return crc32::compare(crc32::compute(replayFrame, replayLength - 4), replayFrame + replayLength - 4);
+  }
+  return crc8::compute(replayFrame, replayLength - 1) == replayFrame[replayLength - 1];
+}
+
+uint16_t replayGoodFrames = 0;
+uint16_t replayBadFrames = 0;
+
+// receive() accepts the frame, answers it and hands it on exactly when compute() finds its CRC good
+void checkReplayedFrame(PJON<ReplayBus> &bus, bool crc32) {
+  bool good = replayFrameCrcGood(crc32);
+  replayPosition = 0;
+  replayResponse = 0;
+  replayPacketsReceived = 0;
+  uint16_t result = bus.receive();
+  CHECK((result == ACK) == good);
+  CHECK(replayResponse == (good ? ACK : NAK));
+  CHECK(replayPacketsReceived == (good ? 1 : 0));
+  good ? replayGoodFrames++ : replayBadFrames++;
+}
+
+// Every frame is received whole, then with a bit flipped in each byte after the length
+void testReceiveCrcMatchesCompute() {
+  PJON<ReplayBus> bus(44);
+  bus.set_receiver(replayReceiver);
+  char payload[40];
+  for (uint8_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = i * 37 + 11;
+  }
+  const uint16_t lengths[] = {1, 3, 20, 40};
+  replayGoodFrames = 0;
+  replayBadFrames = 0;
+  for (uint8_t crc32 = 0; crc32 < 2; crc32++) {
+    bus.set_crc_32(crc32);
+    for (uint8_t l = 0; l < 4; l++) {
+      replayLength = bus.compose_packet(44, NULL, (char *)replayFrame, payload, lengths[l]);
+      CHECK((replayFrame[1] & CRC_BIT) == (crc32 ? CRC_BIT : 0));
+      checkReplayedFrame(bus, crc32);
+      for (uint16_t flip = 3; flip < replayLength; flip++) {
+        replayFrame[flip] ^= 0x10;
+        checkReplayedFrame(bus, crc32);
+        replayFrame[flip] ^= 0x10;
+      }
+    }
+  }
+  CHECK(replayGoodFrames == 8);
+  CHECK(replayBadFrames > 100);
+}
+
+// compose_fragments() writes the same bytes as compose_packet() with the fragments joined, however the
+// payload is split, with either CRC and with the sender info and packet id of an asynchronous ack
+void testFragmentsComposeLikePacket() {
+  PJON<ReplayBus> bus(44);
+  char payload[30];
+  for (uint8_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = i * 53 + 7;
+  }
+  const uint16_t headers[] = {NOT_ASSIGNED, ACK_REQUEST_BIT | ACK_MODE_BIT | SENDER_INFO_BIT};
+  const uint16_t splits[] = {0, 1, 7, 30};
+  for (uint8_t crc32 = 0; crc32 < 2; crc32++) {
+    bus.set_crc_32(crc32);
+    for (uint8_t h = 0; h < 2; h++) {
+      for (uint8_t s = 0; s < 4; s++) {
+        uint16_t split = splits[s];
+        uint16_t middle = (sizeof(payload) - split) / 2;
+        PacketFragment fragments[3] = {
+          {payload, split},
+          {payload + split, middle},
+          {payload + split + middle, (uint16_t)(sizeof(payload) - split - middle)}
+        };
+        char whole[PACKET_MAX_LENGTH];
+        char joined[PACKET_MAX_LENGTH];
+        uint16_t wholeLength = bus.compose_packet(12, NULL, whole, payload, sizeof(payload), headers[h], 0x1234);
+        uint16_t joinedLength = bus.compose_fragments(12, NULL, joined, fragments, 3, headers[h], 0x1234);
+        CHECK(wholeLength > sizeof(payload));
+        CHECK(joinedLength == wholeLength && memcmp(joined, whole, wholeLength) == 0);
+      }
+    }
+  }
+}
+
+// Records the last payload byte of every frame sent, and answers NAK to frames for node 2 while
+// scriptedNaks lasts
+char scriptedSent[200];
+uint8_t scriptedSentCount = 0;
+uint16_t scriptedNaks = 0;
+
+struct ScriptedBus {
+  uint8_t lastReceiver = 0;
+  bool begin(uint8_t = 0) { return true; }
+  bool can_start() { return true; }
+  uint8_t get_max_attempts() { return 50; }
+  uint32_t back_off(uint8_t attempts) { return attempts * 10; }
+  void handle_collision() {}
+  uint16_t receive_byte() { return FAIL; }
+  uint16_t receive_response() {
+    if (lastReceiver == 2 && scriptedNaks > 0) {
+      scriptedNaks--;
+      return NAK;
+    }
+    return ACK;
+  }
+  void send_response(uint8_t) {}
+  void send_string(uint8_t *frame, uint16_t length) {
+    lastReceiver = frame[0];
+    if (scriptedSentCount < sizeof(scriptedSent) - 1) {
+      scriptedSent[scriptedSentCount++] = frame[length - 2];
+      scriptedSent[scriptedSentCount] = 0;
+    }
+  }
+};
+
+void clearScriptedSent() {
+  scriptedSentCount = 0;
+  scriptedSent[0] = 0;
+}
+
+// Call update() steps times, microsBetween apart
+void updateEvery(PJON<ScriptedBus> &bus, uint32_t microsBetween, uint16_t steps) {
+  for (uint16_t i = 0; i < steps; i++) {
+    hostMicros += microsBetween;
+    bus.update();
+  }
+}
+
+// The frames sent with one of payloads, in the order they went out
+const char *scriptedSentOf(const char *payloads) {
+  static char sent[sizeof(scriptedSent)];
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < scriptedSentCount; i++) {
+    if (strchr(payloads, scriptedSent[i]) != NULL) {
+      sent[count++] = scriptedSent[i];
+    }
+  }
+  sent[count] = 0;
+  return sent;
+}
+
+// A packet to node 2 that is retried holds the ones behind it to node 2, not the one to node 3.
+// Taking the head off the chain lets the next packet go.
+void testOrderedChainHeadHoldsReceiver() {
+  PJON<ScriptedBus> bus(1);
+  clearScriptedSent();
+  scriptedNaks = 3;
+  bus.send(2, "A", 1);
+  bus.send(2, "B", 1);
+  bus.send(3, "D", 1);
+  bus.send(2, "C", 1);
+  updateEvery(bus, 100, 40);
+  CHECK(strcmp(scriptedSentOf("ABC"), "AAAABC") == 0);
+  CHECK(strcmp(scriptedSentOf("D"), "D") == 0);
+  CHECK(strchr(scriptedSent, 'D') < strchr(scriptedSent, 'B'));
+  CHECK(bus.update() == 0);
+
+  clearScriptedSent();
+  scriptedNaks = 1000;
+  uint16_t head = bus.send(2, "A", 1);
+  bus.send(2, "B", 1);
+  updateEvery(bus, 1000, 5);
+  CHECK(strchr(scriptedSent, 'B') == NULL);
+  bus.remove(head);
+  scriptedNaks = 0;
+  clearScriptedSent();
+  updateEvery(bus, 1000, 5);
+  CHECK(strcmp(scriptedSent, "B") == 0);
+  CHECK(bus.update() == 0);
+}
+
+// A packet sent repeatedly goes to the back of its chain once sent, behind the ones dispatched since
+void testOrderedRepeatedPacketRequeued() {
+  PJON<ScriptedBus> bus(1);
+  clearScriptedSent();
+  scriptedNaks = 0;
+  bus.send_repeatedly(2, "R", 1, 50000);
+  bus.send(2, "E", 1);
+  // E waits behind R until R first goes after 50 ms, then R goes behind E instead of holding it
+  updateEvery(bus, 1000, 60);
+  CHECK(strcmp(scriptedSent, "RE") == 0);
+  // F waits behind R, and goes as soon as R has been sent again
+  bus.send(2, "F", 1);
+  updateEvery(bus, 1000, 45);
+  CHECK(strcmp(scriptedSent, "RERF") == 0);
+}
+
+// send_packet() composes in a free slot of the send list without queueing it, so it fails once the
+// send list is full
+void testImmediateSendBorrowsFreeSlot() {
+  PJON<ScriptedBus> bus(1);
+  clearScriptedSent();
+  scriptedNaks = 0;
+  CHECK(bus.send_packet(3, (char *)"I", 1) == ACK);
+  CHECK(strcmp(scriptedSent, "I") == 0 && bus.get_packets_count() == 0);
+  for (uint8_t i = 0; i < MAX_PACKETS; i++) {
+    bus.send(3, "Q", 1);
+  }
+  CHECK(bus.send_packet(3, (char *)"J", 1) == FAIL);
+  CHECK(strcmp(scriptedSent, "I") == 0 && bus.get_packets_count() == MAX_PACKETS);
+}
+
+PJON<ScriptedBus> *lostHandlerBus = NULL;
+uint16_t lostHandlerRemoves = 0;
+
+// Like a sketch reacting to a lost packet: drops another packet and sends a new one in its place
+void removeAndSendOnLost(uint8_t code, uint8_t data) {
+  if (code == CONNECTION_LOST) {
+    lostHandlerBus->remove(lostHandlerRemoves);
+    lostHandlerBus->send(5, "W", 1);
+  }
+}
+
+// A packet dispatched from the error handler during update() can land in a slot update() is about to
+// send. It is behind another packet to its receiver, so it waits for it.
+void testOrderedPacketDispatchedInUpdateWaits() {
+  PJON<ScriptedBus> bus(1);
+  lostHandlerBus = &bus;
+  bus.set_error(removeAndSendOnLost);
+  clearScriptedSent();
+  scriptedNaks = 1000;
+  bus.send(2, "A", 1);
+  bus.send_repeatedly(5, "H", 1, 1000000);
+  updateEvery(bus, 10000, bus.strategy.get_max_attempts());
+  lostHandlerRemoves = bus.send(4, "Y", 1);
+  updateEvery(bus, 10000, 1);
+  CHECK(strcmp(scriptedSentOf("HWY"), "") == 0);
+  updateEvery(bus, 10000, 60);
+  CHECK(strcmp(scriptedSentOf("HWY"), "HW") == 0);
+  scriptedNaks = 0;
+}
+
+// Never gets to send, so the send list only changes when a test changes it
+struct QuietBus {
+  bool begin(uint8_t = 0) { return true; }
+  bool can_start() { return false; }
+  uint8_t get_max_attempts() { return 10; }
+  uint32_t back_off(uint8_t attempts) { return attempts; }
+  void handle_collision() {}
+  uint16_t receive_byte() { return FAIL; }
+  uint16_t receive_response() { return ACK; }
+  void send_response(uint8_t) {}
+  void send_string(uint8_t *, uint16_t) {}
+};
+
+// An asynchronous ack removes the packet with its id, and only if it comes from that packet's
+// receiver, on that packet's bus when the network is shared
+void testAsyncAckFindsPacketById() {
+  for (uint8_t shared = 0; shared < 2; shared++) {
+    uint8_t busId[4] = {1, 2, 3, 4};
+    PJON<QuietBus> bus(busId, 1);
+    bus.set_shared_network(shared);
+    bus.set_synchronous_acknowledge(false);
+    bus.set_asynchronous_acknowledge(true);
+    uint16_t one = bus.send(2, "one", 3);
+    uint16_t two = bus.send(2, "two", 3);
+    uint16_t three = bus.send(3, "three", 5);
+    PacketInfo infoOne, infoTwo, infoThree;
+    bus.parse((uint8_t *)bus.packets[one].content, infoOne);
+    bus.parse((uint8_t *)bus.packets[two].content, infoTwo);
+    bus.parse((uint8_t *)bus.packets[three].content, infoThree);
+    CHECK(infoOne.id != 0 && infoTwo.id != 0 && infoThree.id != 0 && infoOne.id != infoTwo.id);
+
+    PacketInfo ack;
+    ack.header = shared ? MODE_BIT : 0;
+    memcpy(ack.sender_bus_id, busId, 4);
+    ack.id = infoTwo.id;
+    ack.sender_id = 3;
+    CHECK(!bus.handle_asynchronous_acknowledgment(ack));
+    ack.sender_id = 2;
+    if (shared) {
+      ack.sender_bus_id[0] = 9;
+      CHECK(!bus.handle_asynchronous_acknowledgment(ack));
+      ack.sender_bus_id[0] = busId[0];
+    }
+    CHECK(bus.handle_asynchronous_acknowledgment(ack));
+    CHECK(bus.packets[two].state == 0 && bus.packets[one].state != 0 && bus.packets[three].state != 0);
+    CHECK(!bus.handle_asynchronous_acknowledgment(ack));
+
+    ack.id = infoThree.id;
+    ack.sender_id = 3;
+    CHECK(bus.handle_asynchronous_acknowledgment(ack));
+    CHECK(bus.get_packets_count() == 1);
+
+    // A new packet in a freed slot is found by its own id, not the one the slot had before
+    uint16_t four = bus.send(2, "four", 4);
+    PacketInfo infoFour;
+    bus.parse((uint8_t *)bus.packets[four].content, infoFour);
+    ack.sender_id = 2;
+    ack.id = infoThree.id;
+    CHECK(!bus.handle_asynchronous_acknowledgment(ack));
+    ack.id = infoFour.id;
+    CHECK(bus.handle_asynchronous_acknowledgment(ack));
+    CHECK(bus.get_packets_count() == 1 && bus.packets[one].state != 0);
+  }
+}
+
+struct RecentIdKey {
+  uint16_t id;
+  uint8_t senderId;
+  uint8_t shared;
+  uint8_t busId;
+};
+
+bool sameRecentId(const RecentIdKey &one, const RecentIdKey &two) {
+  return one.id == two.id && one.senderId == two.senderId && one.shared == two.shared &&
+         (!one.shared || one.busId == two.busId);
+}
+
+// known_packet_id() answers like a plain list of the last MAX_RECENT_PACKET_IDS ids that were new. The
+// ids come from a few hundred senders and ids, far more than the RECENT_ID_TABLE_LENGTH hash table
+// has places for, so they collide and probe around its end, and every id forgotten to make room
+// shifts the entries after it back.
+void testRecentIdsMatchList() {
+  PJON<QuietBus> bus(1);
+  RecentIdKey list[MAX_RECENT_PACKET_IDS];
+  uint8_t listCount = 0;
+  uint8_t listOldest = 0;
+  uint32_t seed = 3;
+  uint16_t known = 0;
+  uint16_t mismatches = 0;
+  for (uint16_t n = 0; n < 20000; n++) {
+    seed = seed * 1103515245 + 12345;
+    RecentIdKey key = {(uint16_t)(1 + (seed >> 8) % 40), (uint8_t)((seed >> 16) % 4),
+                       (uint8_t)((seed >> 20) % 2), (uint8_t)((seed >> 24) % 2)};
+    PacketInfo info;
+    info.id = key.id;
+    info.sender_id = key.senderId;
+    info.header = key.shared ? MODE_BIT : 0;
+    uint8_t senderBusId[4] = {key.busId, 0, 0, 7};
+    memcpy(info.sender_bus_id, senderBusId, 4);
+
+    bool inList = false;
+    for (uint8_t i = 0; i < listCount; i++) {
+      inList = inList || sameRecentId(list[i], key);
+    }
+    if (!inList) {
+      if (listCount < MAX_RECENT_PACKET_IDS) {
+        list[listCount++] = key;
+      } else {
+        list[listOldest] = key;
+        listOldest = (listOldest + 1) % MAX_RECENT_PACKET_IDS;
+      }
+    }
+
+    bool isKnown = bus.known_packet_id(info);
+    known += isKnown;
+    mismatches += isKnown != inList;
+  }
+  CHECK(mismatches == 0);
+  CHECK(known > 100);
+}
+
+int main() {
+  runTest("scheduler runs tasks on time", testSchedulerOnTime);
+  runTest("scheduler reports a blocking callback", testSchedulerBlockingCallback);
+  runTest("scheduler keeps running in runSchedulerFor()", testSchedulerWaitingCallback);
+  runTest("PJON built with GameCommUtils' settings", testPjonSettingsApplied);
+  runTest("connection lost counted for the lost device", testConnectionLostCounted);
+  runTest("expired packets removed and counted", testExpiredPacketsCounted);
+  runTest("response matching no request is dropped", testUnmatchedResponseDropped);
+  runTest("restarted sender's requests are not duplicates", testRestartedSenderNotDuplicate);
+  runTest("sequence windows kept while senders resend", testSequenceWindowsNotEvictedWhileResending);
+  runTest("queued frames do not stop receiving", testQueuedFramesDoNotStopReceiving);
+  runTest("ISR queue wraps and counts overflow", testIsrQueueWrapsAndOverflows);
+  runTest("ISR latest value sent once per change", testIsrLatestCoalesces);
+  runTest("old completion id accepted", testOldCompletionIdAccepted);
+  runTest("receive CRC matches compute()", testReceiveCrcMatchesCompute);
+  runTest("fragments compose like one packet", testFragmentsComposeLikePacket);
+  runTest("ordered chain head holds its receiver only", testOrderedChainHeadHoldsReceiver);
+  runTest("ordered repeated packet goes to chain tail", testOrderedRepeatedPacketRequeued);
+  runTest("ordered packet dispatched in update() waits", testOrderedPacketDispatchedInUpdateWaits);
+  runTest("immediate send borrows a free slot", testImmediateSendBorrowsFreeSlot);
+  runTest("asynchronous ack finds its packet by id", testAsyncAckFindsPacketById);
+  runTest("recent packet ids match a plain list", testRecentIdsMatchList);
+  return failedChecks;
+}
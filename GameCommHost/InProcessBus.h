@@ -0,0 +1,214 @@
+#ifndef InProcessBus_h
+#define InProcessBus_h
+
+// A PJON strategy for the host build. Every simulated node has one, and they all share a single
+// simulated wire, inProcessMedium.
+//
+// Sending a frame costs the sender the time SoftwareBitBang needs to put it on the wire. Every other
+// node then receives it on the spot: the medium switches to that node's clock and runs its
+// bus.receive(), so the real PJON and GameCommUtils code checks the frame, answers ACK or NAK and
+// queues the event. Nodes are treated as always listening, a node that is busy in its game loop
+// still gets the frame, a little later on its own clock. Frames can be lost on the wire with
+// lossPercent, the sender then gets no response and PJON retries as it would on the real bus.
+//
+// runInProcessBus() drives the simulation. It always runs the loop of the node whose clock is
+// furthest behind, so the clocks stay close together.
+
+#include <PJONDefines.h>
+
+#ifndef IN_PROCESS_MAX_NODES
+#define IN_PROCESS_MAX_NODES 9
+#endif
+
+// Wire time of one byte with SoftwareBitBang: the padding bit, the sync bit and 8 data bits
+#define IN_PROCESS_BYTE_MICROS (SWBB_BIT_SPACER + 9 * SWBB_BIT_WIDTH)
+
+// What a receive attempt on a quiet wire costs
+#define IN_PROCESS_IDLE_MICROS 4
+
+class InProcessBus;
+
+struct inProcessNodeStruct {
+  InProcessBus *strategy = NULL;
+  void (*loop)() = NULL;             // One pass of the node's loop()
+  void (*receive)() = NULL;          // Calls the node's bus.receive()
+  uint32_t clock = 0;                // hostMicros of the node
+};
+
+struct inProcessMediumStruct {
+  inProcessNodeStruct nodes[IN_PROCESS_MAX_NODES];
+  uint8_t numNodes = 0;
+  uint8_t running = 0;               // Node whose code is running
+  uint32_t busyUntil = 0;            // End of the last frame and its response
+  uint16_t response = FAIL;          // What the addressed node answered to the last frame
+  uint8_t lossPercent = 0;
+
+  // Totals
+  uint32_t frames = 0;
+  uint32_t bytes = 0;
+  uint32_t framesLost = 0;
+  uint32_t busyStarts = 0;           // Sends that found the wire busy
+  uint32_t airMicros = 0;            // Time the wire carried frames or responses
+};
+
+inProcessMediumStruct inProcessMedium;
+
+uint32_t laterClock(uint32_t a, uint32_t b) {
+  return (int32_t)(a - b) >= 0 ? a : b;
+}
+
+class InProcessBus {
+  public:
+    /* Same back off as SoftwareBitBang */
+    uint32_t back_off(uint8_t attempts) {
+      uint32_t result = attempts;
+      for (uint8_t d = 0; d < SWBB_BACK_OFF_DEGREE; d++) {
+        result *= (uint32_t)(attempts);
+      }
+      return result;
+    };
+
+    boolean begin(uint8_t additional_randomness = 0) {
+      return true;
+    };
+
+    /* The wire is free once the last frame and its response are over */
+    boolean can_start() {
+      if ((int32_t)(hostMicros - inProcessMedium.busyUntil) < 0) {
+        inProcessMedium.busyStarts++;
+        return false;
+      }
+      return true;
+    };
+
+    static uint8_t get_max_attempts() {
+      return SWBB_MAX_ATTEMPTS;
+    };
+
+    void handle_collision() {
+      delayMicroseconds(random(0, SWBB_COLLISION_DELAY));
+    };
+
+    uint16_t receive_byte() {
+      if (rxPosition < rxLength) {
+        return rx[rxPosition++];
+      }
+      delayMicroseconds(IN_PROCESS_IDLE_MICROS);
+      return FAIL;
+    };
+
+    /* The addressed node has already answered, in send_string() */
+    uint16_t receive_response() {
+      uint16_t response = inProcessMedium.response;
+      inProcessMedium.response = FAIL;
+      if (response == FAIL) {
+        delayMicroseconds(SWBB_TIMEOUT);
+      } else {
+        delayMicroseconds(IN_PROCESS_BYTE_MICROS);
+      }
+      return response;
+    };
+
+    void send_response(uint8_t response) {
+      inProcessMedium.response = response;
+      inProcessMedium.airMicros += IN_PROCESS_BYTE_MICROS;
+      delayMicroseconds(IN_PROCESS_BYTE_MICROS);
+    };
+
+    void send_string(uint8_t *string, uint16_t length) {
+      uint32_t airTime = length * IN_PROCESS_BYTE_MICROS;
+      delayMicroseconds(airTime);
+      inProcessMedium.busyUntil = hostMicros + IN_PROCESS_BYTE_MICROS;
+      inProcessMedium.response = FAIL;
+      inProcessMedium.frames++;
+      inProcessMedium.bytes += length;
+      inProcessMedium.airMicros += airTime;
+      if (length > PACKET_MAX_LENGTH) {
+        return;
+      }
+      if (inProcessMedium.lossPercent > 0 && random(0, 100) < inProcessMedium.lossPercent) {
+        inProcessMedium.framesLost++;
+        return;
+      }
+
+      uint8_t sender = inProcessMedium.running;
+      uint32_t arrival = hostMicros;
+      for (uint8_t i = 0; i < inProcessMedium.numNodes; i++) {
+        inProcessNodeStruct &node = inProcessMedium.nodes[i];
+        if (i == sender) {
+          continue;
+        }
+        memcpy(node.strategy->rx, string, length);
+        node.strategy->rxLength = length;
+        node.strategy->rxPosition = 0;
+        inProcessMedium.running = i;
+        hostMicros = laterClock(node.clock, arrival);
+        node.receive();
+        node.clock = hostMicros;
+        node.strategy->rxLength = 0;
+      }
+      inProcessMedium.running = sender;
+      hostMicros = arrival;
+    };
+
+    /* Nothing to wire up, kept so GameCommUtils can set the pin as usual */
+    void set_pin(uint8_t pin) { };
+
+  private:
+    uint8_t rx[PACKET_MAX_LENGTH];
+    uint16_t rxLength = 0;
+    uint16_t rxPosition = 0;
+};
+
+/**
+ * Put a node on the wire. Its clock starts at the current hostMicros.
+ */
+bool attachInProcessNode(InProcessBus &strategy, void (*loop)(), void (*receive)()) {
+  if (inProcessMedium.numNodes >= IN_PROCESS_MAX_NODES) {
+    return false;
+  }
+  inProcessNodeStruct &node = inProcessMedium.nodes[inProcessMedium.numNodes++];
+  node.strategy = &strategy;
+  node.loop = loop;
+  node.receive = receive;
+  node.clock = hostMicros;
+  return true;
+}
+
+/**
+ * Put a node in the place of the one at index, as if that node had restarted. The clock goes on.
+ */
+bool replaceInProcessNode(uint8_t index, InProcessBus &strategy, void (*loop)(), void (*receive)()) {
+  if (index >= inProcessMedium.numNodes) {
+    return false;
+  }
+  inProcessNodeStruct &node = inProcessMedium.nodes[index];
+  node.strategy = &strategy;
+  node.loop = loop;
+  node.receive = receive;
+  return true;
+}
+
+/**
+ * Run the node loops until every node's clock has reached untilMicros.
+ */
+void runInProcessBus(uint32_t untilMicros) {
+  while (inProcessMedium.numNodes > 0) {
+    uint8_t next = 0;
+    for (uint8_t i = 1; i < inProcessMedium.numNodes; i++) {
+      if ((int32_t)(inProcessMedium.nodes[i].clock - inProcessMedium.nodes[next].clock) < 0) {
+        next = i;
+      }
+    }
+    inProcessNodeStruct &node = inProcessMedium.nodes[next];
+    if ((int32_t)(node.clock - untilMicros) >= 0) {
+      return;
+    }
+    inProcessMedium.running = next;
+    hostMicros = node.clock;
+    node.loop();
+    node.clock = hostMicros;
+  }
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef PJONNames_h
+#define PJONNames_h
+
+// The vendored PJON predates the PJON_ prefixed names GameCommUtils is written against. Include this
+// before GameCommUtils.h in every host program that builds it.
+
+#define PJON_Packet_Info PacketInfo
+#define PJON_CONNECTION_LOST CONNECTION_LOST
+#define PJON_PACKETS_BUFFER_FULL PACKETS_BUFFER_FULL
+#define PJON_CONTENT_TOO_LONG CONTENT_TOO_LONG
+#define PJON_FAIL FAIL
+#define PJON_NAK NAK
+#define PJON_ACK ACK
+
+#endif
@@ -0,0 +1,123 @@
+// Send path benchmark. Times the sends the sketches make, the old way with a String payload next to
+// the String-free way they use now, and counts the heap every send uses.
+//
+//   make SendBenchmark && ./SendBenchmark
+//
+// Every send goes all the way through GameCommUtils and PJON to a bus that answers ACK at once, so
+// the time includes composing the frame, PJON's send and the bookkeeping after it. The difference
+// between the rows is what building the payload costs. Heap is what the host String, which
+// allocates like Arduino's, holds at most during a send, with AVR's 2 bytes of malloc() overhead per
+// block. Cycles are read from the time stamp counter on x86, elsewhere only ns per send is shown.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SEND_BENCH_CYCLES 1
+#endif
+#include "PJONNames.h"
+
+#define GAME_COMM_STRATEGY_HEADER <AckingBus.h>
+#define GAME_COMM_STRATEGY AckingBus
+#define GAME_COMM_BATCH_WINDOW 0     // Every send goes out in its own frame
+#define PJON_INCLUDE_ASYNC_ACK false // Nothing behind AckingBus sends async acks, packets would never leave
+#include <GameCommUtils.h>
+
+uint32_t hostMicros = 0;
+bool hostSerialEcho = false;
+Stream Serial;
+
+#define SENDS_PER_CASE 20000
+
+// What CommTestNode used to build its pings from
+String PING_STR = "Ping ";
+int pingSendCount = 0;
+
+void pingAsString() {
+  sendEventToNode(MP3_PLAYER_NODE, CE_PING, PING_STR + pingSendCount++);
+}
+
+void pingAsInt() {
+  sendIntEventToNode(MP3_PLAYER_NODE, CE_PING, pingSendCount++);
+}
+
+// playTrack() used to take a String, every call with a literal made one
+void trackAsString(String track) {
+  sendEventToNode(MP3_PLAYER_NODE, CE_PLAY_TRACK, track);
+}
+
+void trackAsStringLiteral() {
+  trackAsString("track11");
+}
+
+void trackAsText() {
+  sendEventToNode(MP3_PLAYER_NODE, CE_PLAY_TRACK, "track11");
+}
+
+void trackAsFlash() {
+  sendEventToNode(MP3_PLAYER_NODE, CE_PLAY_TRACK, F("track11"));
+}
+
+struct sendCase {
+  const char *name;
+  void (*send)();
+};
+
+const sendCase cases[] = {
+  { "String \"Ping \" + count",  pingAsString },
+  { "int count",                pingAsInt },
+  { "String(\"track11\")",       trackAsStringLiteral },
+  { "const char* \"track11\"",  trackAsText },
+  { "F(\"track11\")",            trackAsFlash }
+};
+
+uint64_t readCycles() {
+#ifdef SEND_BENCH_CYCLES
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+int main() {
+  initCommunications(GAME_CONTROLLER_NODE);
+
+#ifdef SEND_BENCH_CYCLES
+  printf("%-26s %10s %10s %12s %12s\n", "Payload", "cycles", "ns", "heap peak B", "allocations");
+  printf("%-26s %10s %10s %12s %12s\n", "", "(median)", "(mean)", "", "per send");
+#else
+  printf("%-26s %10s %12s %12s\n", "Payload", "ns", "heap peak B", "allocations");
+  printf("%-26s %10s %12s %12s\n", "", "(mean)", "", "per send");
+#endif
+
+  std::vector<uint64_t> cycles(SENDS_PER_CASE);
+  for (const sendCase &c : cases) {
+    for (uint16_t i = 0; i < 1000; i++) {
+      c.send();            // Warm up
+    }
+    hostHeapStruct &heap = hostHeap();
+    uint32_t heapBefore = heap.inUse;
+    uint32_t allocationsBefore = heap.allocations;
+    heap.peak = heap.inUse;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < SENDS_PER_CASE; i++) {
+      uint64_t cyclesStart = readCycles();
+      c.send();
+      cycles[i] = readCycles() - cyclesStart;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / SENDS_PER_CASE;
+    std::sort(cycles.begin(), cycles.end());
+
+#ifdef SEND_BENCH_CYCLES
+    printf("%-26s %10llu %10.1f %12u %12.2f\n", c.name, (unsigned long long)cycles[SENDS_PER_CASE / 2], ns,
+           heap.peak - heapBefore, (heap.allocations - allocationsBefore) / (double)SENDS_PER_CASE);
+#else
+    printf("%-26s %10.1f %12u %12.2f\n", c.name, ns,
+           heap.peak - heapBefore, (heap.allocations - allocationsBefore) / (double)SENDS_PER_CASE);
+#endif
+  }
+  return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef SoftwareSerial_h
+#define SoftwareSerial_h
+
+// GameCommUtils includes SoftwareSerial for older PJON versions. Nothing in the host build uses it.
+
+#endif
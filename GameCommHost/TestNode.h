@@ -0,0 +1,45 @@
+// One simulated node of HostTests. No include guard, like BenchNode.h: HostTests.cpp includes this
+// once per node with TEST_NODE set to a new namespace name, and each copy gets its own GameCommUtils.
+
+#define GAME_COMM_NAMESPACE TEST_NODE
+#undef GameCommUtils_h
+#include <GameCommUtils.h>
+#undef GAME_COMM_NAMESPACE
+
+namespace TEST_NODE {
+
+void (*nextStep)() = NULL;       // Run by the next loop() pass, for a test to act as this node
+
+// Like processReceive(), the node does not listen while it holds a frame for room in its queue
+void receiveFrame() {
+  if (!readyToReceive()) {
+    return;
+  }
+  bus.receive();
+}
+
+void loop() {
+  if (nextStep != NULL) {
+    void (*step)() = nextStep;
+    nextStep = NULL;
+    step();
+  }
+  doComm();
+}
+
+void setup(uint8_t nodeId) {
+  initCommunications(nodeId);
+  attachInProcessNode(bus.strategy, loop, receiveFrame);
+}
+
+// Take the place of the node at wireIndex, as that node restarting with the fresh state of this copy
+void restart(uint8_t nodeId, uint8_t wireIndex) {
+  hostMicros = inProcessMedium.nodes[wireIndex].clock;
+  initCommunications(nodeId);
+  inProcessMedium.nodes[wireIndex].clock = hostMicros;
+  replaceInProcessNode(wireIndex, bus.strategy, loop, receiveFrame);
+}
+
+}
+
+#undef TEST_NODE
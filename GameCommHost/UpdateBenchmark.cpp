@@ -0,0 +1,92 @@
+// PJON update() benchmark. Times update() with a growing number of packets waiting in the send list,
+// to see what raising MAX_PACKETS costs every doComm() pass.
+//
+//   make UpdateBenchmark && ./UpdateBenchmark
+//
+// Three cases for every send list occupancy:
+//   idle         Every packet waits for a later retry, update() has nothing to send
+//   one due      Like idle, plus one packet dispatched before each call that update() sends
+//   scan         The loop update() used to run on an idle list, checking the retry time of every slot
+//
+// The bus answers every packet with ACK at once, so only PJON's own bookkeeping is timed.
+
+#ifndef MAX_PACKETS
+#define MAX_PACKETS 64
+#endif
+
+#include <Arduino.h>
+#include <PJON.h>
+#include <chrono>
+
+uint32_t hostMicros = 0;
+bool hostSerialEcho = false;
+Stream Serial;
+
+struct AckingBus {
+  bool begin(uint8_t = 0) { return true; }
+  bool can_start() { return true; }
+  uint8_t get_max_attempts() { return 10; }
+  uint32_t back_off(uint8_t attempts) { return attempts * attempts * attempts; }
+  void handle_collision() {}
+  uint16_t receive_byte() { return FAIL; }
+  uint16_t receive_response() { return ACK; }
+  void send_response(uint8_t) {}
+  void send_string(uint8_t *, uint16_t) {}
+};
+
+PJON<AckingBus> bus(1);
+volatile uint32_t benchSink;    // Keeps the timed scan from being optimized away
+
+// The old update() loop for a list where nothing is due
+uint8_t scanEverySlot() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < MAX_PACKETS; i++) {
+    if (bus.packets[i].state == 0) {
+      continue;
+    }
+    count++;
+    if ((uint32_t)(micros() - bus.packets[i].registration) >
+        (uint32_t)(bus.packets[i].timing + bus.strategy.back_off(bus.packets[i].attempts))) {
+      count++;
+    }
+  }
+  return count;
+}
+
+template <typename Function>
+double nanosPerCall(Function function) {
+  uint32_t calls = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point end = start;
+  while (end - start < std::chrono::milliseconds(100)) {
+    for (uint16_t i = 0; i < 1000; i++) {
+      function();
+    }
+    calls += 1000;
+    end = std::chrono::steady_clock::now();
+  }
+  return std::chrono::duration<double, std::nano>(end - start).count() / calls;
+}
+
+int main() {
+  const char content[] = "benchmark";
+  printf("MAX_PACKETS %d, ns per update() call\n\n", MAX_PACKETS);
+  printf("%8s %10s %10s %10s\n", "waiting", "idle", "one due", "scan");
+
+  for (uint8_t waiting = 0; waiting < MAX_PACKETS; waiting = (waiting == 0) ? 1 : waiting * 2) {
+    bus.remove_all_packets();
+    for (uint8_t i = 0; i < waiting; i++) {
+      // A repeated packet far in the future stays in the list and never comes due. It goes to
+      // another node than the due ones, so with ORDERED_SENDING they do not wait behind it.
+      bus.send_repeatedly(3, content, sizeof(content), 2000000000);
+    }
+    double idle = nanosPerCall([]() { benchSink = bus.update(); });
+    double oneDue = nanosPerCall([&content]() {
+      bus.send(2, content, sizeof(content));
+      benchSink = bus.update();
+    });
+    double scan = nanosPerCall([]() { benchSink = scanEverySlot(); });
+    printf("%8u %10.1f %10.1f %10.1f\n", waiting, idle, oneDue, scan);
+  }
+  return 0;
+}
@@ -5,20 +5,65 @@
 // PJON 5.2 does not have this properly included.
 #include <SoftwareSerial.h>
 
+// PJON settings. The vendored PJON reads them without the PJON_ prefix, newer PJON with it, so both
+// spellings are defined. A sketch can set either one before it includes GameCommUtils.h.
+
 // Turn on Asynchronous Acknowledgments at the PJON packet level.
+#if !defined(PJON_INCLUDE_ASYNC_ACK) && defined(INCLUDE_ASYNC_ACK)
+#define PJON_INCLUDE_ASYNC_ACK INCLUDE_ASYNC_ACK
+#endif
+#ifndef PJON_INCLUDE_ASYNC_ACK
 #define PJON_INCLUDE_ASYNC_ACK true
+#endif
+#ifndef INCLUDE_ASYNC_ACK
+#define INCLUDE_ASYNC_ACK PJON_INCLUDE_ASYNC_ACK
+#endif
+
 // Set the number of send attempts in PJON - default in library is 42. NO IT ISN'T. WHERE IS THIS?
 //#define MAX_ATTEMPTS 200
+#ifndef SWBB_MAX_ATTEMPTS
 #define SWBB_MAX_ATTEMPTS 35
+#endif
+#if !defined(PJON_MAX_PACKETS) && defined(MAX_PACKETS)
+#define PJON_MAX_PACKETS MAX_PACKETS
+#endif
+#ifndef PJON_MAX_PACKETS
 #define PJON_MAX_PACKETS 7
+#endif
+#ifndef MAX_PACKETS
+#define MAX_PACKETS PJON_MAX_PACKETS
+#endif
+// Only a sketch that needs a longer dedup window sets this one
+#if defined(PJON_MAX_RECENT_PACKET_IDS) && !defined(MAX_RECENT_PACKET_IDS)
+#define MAX_RECENT_PACKET_IDS PJON_MAX_RECENT_PACKET_IDS
+#elif defined(MAX_RECENT_PACKET_IDS) && !defined(PJON_MAX_RECENT_PACKET_IDS)
+#define PJON_MAX_RECENT_PACKET_IDS MAX_RECENT_PACKET_IDS
+#endif
 #define PJON_INCLUDE_SWBB
 #include <PJON.h>
 
+// The bus strategy. Nodes use SoftwareBitBang. The host build in GameCommHost puts its in process
+// strategy here with GAME_COMM_STRATEGY_HEADER and GAME_COMM_STRATEGY.
+#ifdef GAME_COMM_STRATEGY_HEADER
+#include GAME_COMM_STRATEGY_HEADER
+#endif
+#ifndef GAME_COMM_STRATEGY
+#define GAME_COMM_STRATEGY SoftwareBitBang
+#endif
+
 using namespace std;
 
 // Uncomment for comm utils serial prints.
 #define DO_COMM_UTILS_DEBUG
 
+#include <GameScheduler.h>
+
+// The host build includes this file once per simulated node, each time in its own namespace, so
+// every node gets its own bus, queues and stats.
+#ifdef GAME_COMM_NAMESPACE
+namespace GAME_COMM_NAMESPACE {
+#endif
+
 #define COMM_PIN 3
 
 // The various game nodes connected together
@@ -30,6 +75,7 @@ using namespace std;
 #define DOCK_PLANKS_GAME_NODE     60       // Dock planks
 #define LICENSE_PLATE_GAME_NODE   70	   // License plate game. Duh.
 #define HELP_RADIO_NODE           80       // The help radio system. 
+#define SHIP_WHEEL_LOCK_NODE      90       // Ship's wheel combination lock
 
 // These are things that aren't really nodes(although keypad IS attached to comm) but happen along the way and  have help
 #define CAMPING_GAME              55       // After fishsorting
@@ -42,6 +88,10 @@ using namespace std;
 // COMM_EVENTS (CE) - Values from 10-99 Only
 // Events < 50 are typically sent form the CONTROLLER to the PUZZLE. Add 50 to the event to get the event that goes in the opposite direction
 // Events > 50 are typically sent from a PUZZLE to the CONTROLLER  
+// Every event is also declared in the event schema below, which checks these rules at compile time.
+#define FIRST_EVENT_ID 10
+#define LAST_EVENT_ID  99
+
 #define CE_START_PUZZLE          10
 #define CE_START_SUB_PUZZLE      15      // The Front Door Knocker intervenes between other puzzles
 #define CE_PUZZLE_START_SUCCESS  60      // Event passed from PUZZLE to Game Master
@@ -56,7 +106,16 @@ using namespace std;
 #define CE_PUZZLE_NOT_STARTED    70
 #define CE_PUZZLE_IN_PROGRESS    71
 #define CE_PUZZLE_COMPLETED      72
-#define CE_PUZZLE_COMPLETED_SUCCESS 62   // Event passed from Game Controller to Puzzle in response to puzzle complete
+#define CE_PUZZLE_COMPLETED_SUCCESS 22   // Event passed from Game Controller to Puzzle in response to puzzle complete
+#define CE_OLD_PUZZLE_COMPLETED_SUCCESS 62   // Its id before, shared with CE_RESET_AND_START_SUCCESS. See currentEventId().
+
+#define CE_REQUEST_STATS         25      // DATA: int, index of the comm stats entry wanted. Answered by GameCommUtils.
+#define CE_STATS                 75      // DATA: bytes, one comm stats entry. No data past the last entry.
+
+#define CE_REQUEST_STATE_SYNC    26      // Ask a puzzle for its whole state record. Answered by GameCommUtils.
+#define CE_STATE_DELTA           76      // DATA: bytes, changed puzzle state fields. See setStateField().
+
+#define CE_DIAL_POSITION         77      // DATA: int, raw position of a puzzle's dial or wheel. See setLatestFromISR().
 
 // Health related events
 #define CE_PING                 50
@@ -68,6 +127,31 @@ using namespace std;
 #define CE_PLAY_TRACK_SUCCESS   81
 
 
+// Priority classes. Frames of a higher class (lower value) are handed to PJON first and pass queued
+// frames of lower classes for the same node. When there is no room, frames of lower classes are
+// dropped to make it. Control frames are also exempt from the per node in flight limit, so a reset
+// goes out at once whatever else is queued.
+enum GamePriority {
+  GAME_PRIORITY_CONTROL = 0,    // Reset and start, and their answers
+  GAME_PRIORITY_GAME,           // Puzzle progress, everything not listed elsewhere
+  GAME_PRIORITY_AUDIO,          // Track requests for the MP3 node
+  GAME_PRIORITY_TELEMETRY,      // Health checks and stats
+  GAME_PRIORITY_BY_EVENT        // Take the class from eventPriority()
+};
+
+// Events can expire. An event that has not been delivered within its expiry time is dropped, from
+// the outbound queue or from PJON, instead of being retried, and counted as expired in the stats.
+// By default audio and telemetry expire, a hint track or a ping is no use once it is late. Control
+// and game events never do. An expiry of 0 never expires.
+#ifndef GAME_AUDIO_EXPIRE_MILLIS
+#define GAME_AUDIO_EXPIRE_MILLIS     3000
+#endif
+#ifndef GAME_TELEMETRY_EXPIRE_MILLIS
+#define GAME_TELEMETRY_EXPIRE_MILLIS 2000
+#endif
+#define GAME_NEVER_EXPIRE            0
+#define GAME_EXPIRE_BY_PRIORITY      0xFFFF    // Take the expiry of the event's priority class
+
 // Keeping these for backward compatibility until code is updated
 //#define PUZZLE_COMPLETED     CE_PUZZLE_COMPLETED
 //#define PLAY_TRACK           CE_PLAY_TRACK
@@ -76,9 +160,17 @@ using namespace std;
 //////////////////////////////////////
 
 
-// This can be changed by a given node as makes sense.
+// This can be changed by a given node as makes sense. The most time, in microseconds, doComm() listens
+// for incoming frames.
 int commUtilsReceiveTimeout = 2000;
 
+// doComm() stops listening once the bus has been quiet this long (microseconds), long before
+// commUtilsReceiveTimeout if nothing is being sent. A frame that is arriving keeps it listening.
+#ifndef GAME_COMM_QUIET_MICROS
+#define GAME_COMM_QUIET_MICROS 300
+#endif
+unsigned int commQuietMicros = GAME_COMM_QUIET_MICROS;
+
 int resetCard[5] = {185,233,104,133,189};  // This is the ID(s) of the reset card
 
 
@@ -88,308 +180,2545 @@ int resetCard[5] = {185,233,104,133,189};  // This is the ID(s) of the reset car
 
 #define MAX_EVENT_DATA 20
 
+// Uncomment to keep sending the old fixed length '^' ASCII frames. Only needed while nodes running
+// the old GameCommUtils are still on the bus. Both frame formats are always decoded.
+//#define GAME_COMM_SEND_LEGACY_FRAMES
+
+// Binary event frame, version 1:
+//   [0]  GAME_FRAME_V1  Frame marker. Also the frame version. Never the same as GAME_START_PACKET_CHAR.
+//   [1]  Event id       10-99
+//   [2]  Payload type   Low nibble is one of GAME_PAYLOAD_*. High nibble is GAME_FRAME_FLAG_* bits.
+//   [3]  Payload length Number of payload bytes, not counting the optional fields.
+//   [4-] Optional fields, in flag bit order, only present if their flag is set:
+//          Correlation id (1 byte) - GAME_FRAME_FLAG_CORRELATION
+//          Boot epoch and sequence number (1 byte each) - GAME_FRAME_FLAG_SEQUENCE
+//        Payload
+// An event without data is 4 bytes on the wire, an int event is 6 bytes.
+//
+// Batch frame: several events for the same node in one bus frame.
+//   [0]  GAME_FRAME_BATCH
+//   [1-] Records, in the order they were sent. A record is a binary frame without its marker byte.
+// A batch holding a single event is sent as a plain GAME_FRAME_V1 frame.
+#define GAME_FRAME_V1            0xB1
+#define GAME_FRAME_BATCH         0xB2
+#define GAME_FRAME_HEADER_LENGTH 4
+#define GAME_FRAME_MAX_OPTIONAL  3
+#define GAME_MAX_FRAME_LENGTH    (GAME_FRAME_HEADER_LENGTH + GAME_FRAME_MAX_OPTIONAL + MAX_EVENT_DATA)
+
+#define GAME_PAYLOAD_TYPE_MASK   0x0F
+
+// Events sent to the same node within GAME_COMM_BATCH_WINDOW milliseconds of the first one are packed
+// into one batch frame. 0 sends every event in its own frame. Not used for legacy frames.
+#ifndef GAME_COMM_BATCH_WINDOW
+#define GAME_COMM_BATCH_WINDOW   5
+#endif
+#define GAME_MAX_BATCH_LENGTH    32    // Bytes, marker included. Must fit in a PJON packet with its overhead.
+// The receiver queues every event of a batch as it arrives, so a batch holds no more events than the
+// receivers' RECEIVED_EVENT_QUEUE_SIZE.
+#ifndef GAME_MAX_BATCH_EVENTS
+#define GAME_MAX_BATCH_EVENTS    4
+#endif
+
+// Frame flags
+#define GAME_FRAME_FLAG_CORRELATION 0x10   // Frame carries a request/response correlation id
+#define GAME_FRAME_FLAG_SEQUENCE    0x20   // Frame carries the sender's boot epoch and sequence number, resends keep the same one
+
+// Payload types
+#define GAME_PAYLOAD_NONE        0     // No data
+#define GAME_PAYLOAD_STRING      1     // Characters, no terminator sent
+#define GAME_PAYLOAD_INT         2     // 16 bit signed integer, low byte first
+#define GAME_PAYLOAD_BYTES       3     // Raw bytes
+
 struct eventDataStruct {
   int sentFrom = -1;
   int event = -1;
-  char data[MAX_EVENT_DATA+1] = "";  // Need the +1 for the string terminator.
+  char data[MAX_EVENT_DATA+1] = "";  // Need the +1 for the string terminator. Int payloads are also written here as text.
+  uint8_t dataType = GAME_PAYLOAD_NONE;
+  uint8_t dataLength = 0;            // Number of payload bytes in data, not counting the terminator.
+  int intData = 0;                   // Only set for GAME_PAYLOAD_INT
+  uint8_t correlationId = 0;         // Request correlation id to echo in the response, 0 if none
+  uint8_t sequence = 0;              // Sender's sequence number, 0 if the frame has none
+  uint8_t bootEpoch = 0;             // Sender's boot epoch, only set with a sequence number
 };
 
+// Event schema. Each event is declared once with its id, the direction it travels, the event that
+// answers it and the type of its payload:
+//
+//   typedef GameEvent<CE_REQUEST_STATS, GAME_TO_PUZZLE, CE_STATS, int> RequestStatsEvent;
+//
+//   sendGameRequest<RequestStatsEvent>(nodeId, index, callback);          // Response event comes from the schema
+//   const int *index = gameEventPayload<RequestStatsEvent>(eventData);    // NULL if eventData is not one
+//
+// Payload types:
+//   NoPayload    No data
+//   int          GAME_PAYLOAD_INT, read from eventData.intData
+//   TextPayload  A string of up to MAX_EVENT_DATA characters, read in place as a const char *
+//   A struct     GAME_PAYLOAD_BYTES, sent as it is laid out in memory and read in place from
+//                eventData.data. Declare it __attribute__((packed)) with fixed size fields. Multi
+//                byte fields go low byte first, which is how every board we use stores them.
+//
+// Ids outside 10-99, payloads longer than MAX_EVENT_DATA, two events with the same id, events going
+// the wrong way for their id and replies that are not declared all fail to compile.
+#define GAME_TO_PUZZLE      0    // Controller to puzzle, ids below 50
+#define GAME_TO_CONTROLLER  1    // Puzzle to controller, ids 50 and up
+#define GAME_TO_ANY         2    // Any node to any node
+#define NO_REPLY_EVENT      0
+
+struct NoPayload {};
+struct TextPayload {};
+struct BytesPayload {};
+
+struct CommStatsPayload {
+  uint8_t nodeId;
+  uint8_t expired;                 // Stops at 255 on the wire
+  uint16_t framesSent;
+  uint16_t attempts;
+  uint16_t naks;
+  uint16_t connectionLost;
+  uint16_t bufferFull;
+  uint8_t junkReceived;            // Stops at 255 on the wire
+  uint8_t eventsDropped;           // Stops at 255 on the wire
+  uint16_t rttMin;
+  uint16_t rttAvg;
+  uint16_t rttMax;
+} __attribute__((packed));
+
+// How each payload type is put on the wire and found again in eventDataStruct. bytes() returns the
+// payload bytes to send, NULL if the payload can not be encoded. view() points into the event.
+template <typename Payload> struct GamePayloadTraits {
+  static_assert(alignof(Payload) == 1, "Struct payloads must be declared __attribute__((packed))");
+  // Checked on sizeof() itself, length is a uint8_t and a 256 byte struct would pass as 0.
+  static_assert(sizeof(Payload) <= MAX_EVENT_DATA, "Event payload is longer than MAX_EVENT_DATA");
+  typedef const Payload &Arg;
+  typedef Payload View;
+  static const uint8_t type = GAME_PAYLOAD_BYTES;
+  static const uint8_t length = sizeof(Payload);
+  static const bool fixedLength = true;
+  static const uint8_t *bytes(Arg payload, uint8_t *scratch, uint8_t &dataLen) {
+    dataLen = sizeof(Payload);
+    return reinterpret_cast<const uint8_t *>(&payload);
+  }
+  static const View *view(const eventDataStruct &event) {
+    return reinterpret_cast<const View *>(event.data);
+  }
+};
 
+template <> struct GamePayloadTraits<NoPayload> {
+  typedef NoPayload View;
+  static const uint8_t type = GAME_PAYLOAD_NONE;
+  static const uint8_t length = 0;
+  static const bool fixedLength = true;
+  static const View *view(const eventDataStruct &event) {
+    return reinterpret_cast<const View *>(event.data);
+  }
+};
 
-static void (*gameEventOccurred)(void);
+template <> struct GamePayloadTraits<int> {
+  typedef int Arg;
+  typedef int View;
+  static const uint8_t type = GAME_PAYLOAD_INT;
+  static const uint8_t length = 2;
+  static const bool fixedLength = true;
+  static const uint8_t *bytes(Arg payload, uint8_t *scratch, uint8_t &dataLen) {
+    scratch[0] = payload & 0xFF;
+    scratch[1] = (payload >> 8) & 0xFF;
+    dataLen = 2;
+    return scratch;
+  }
+  static const View *view(const eventDataStruct &event) {
+    return &event.intData;
+  }
+};
+
+template <> struct GamePayloadTraits<TextPayload> {
+  typedef const char *Arg;
+  typedef char View;
+  static const uint8_t type = GAME_PAYLOAD_STRING;
+  static const uint8_t length = MAX_EVENT_DATA;
+  static const bool fixedLength = false;
+  static const uint8_t *bytes(Arg payload, uint8_t *scratch, uint8_t &dataLen) {
+    size_t textLen = (payload == NULL) ? 0 : strlen(payload);
+    dataLen = textLen;
+    return (textLen > MAX_EVENT_DATA) ? NULL : reinterpret_cast<const uint8_t *>(payload);
+  }
+  static const View *view(const eventDataStruct &event) {
+    return event.data;
+  }
+};
+
+// Up to MAX_EVENT_DATA raw bytes, read in place as a const uint8_t *. Sent with sendPayloadToNode().
+template <> struct GamePayloadTraits<BytesPayload> {
+  typedef uint8_t View;
+  static const uint8_t type = GAME_PAYLOAD_BYTES;
+  static const uint8_t length = MAX_EVENT_DATA;
+  static const bool fixedLength = false;
+  static const View *view(const eventDataStruct &event) {
+    return reinterpret_cast<const View *>(event.data);
+  }
+};
+
+template <uint8_t Id, uint8_t Direction, uint8_t ReplyId, typename PayloadType>
+struct GameEvent {
+  static_assert(Id >= FIRST_EVENT_ID && Id <= LAST_EVENT_ID, "Event ids are 10-99");
+  static_assert(GamePayloadTraits<PayloadType>::length <= MAX_EVENT_DATA, "Event payload is longer than MAX_EVENT_DATA");
+  static_assert(Direction != GAME_TO_PUZZLE || Id < 50, "Events sent to a puzzle have ids below 50");
+  static_assert(Direction != GAME_TO_CONTROLLER || Id >= 50, "Events sent to the controller have ids of 50 and up");
+  static_assert(ReplyId == NO_REPLY_EVENT || (ReplyId >= FIRST_EVENT_ID && ReplyId <= LAST_EVENT_ID), "Reply ids are 10-99");
+
+  typedef PayloadType Payload;
+  typedef GamePayloadTraits<PayloadType> Traits;
+  typedef typename Traits::View View;
+  static const uint8_t id = Id;
+  static const uint8_t direction = Direction;
+  static const uint8_t replyId = ReplyId;
+};
+
+// A list of events that checks its ids are unique and that every reply is in the list.
+template <typename... Events> struct GameEventList;
+
+template <> struct GameEventList<> {
+  static constexpr bool contains(uint8_t) { return false; }
+  static constexpr bool uniqueIds() { return true; }
+  template <typename All> static constexpr bool repliesIn() { return true; }
+};
+
+template <typename First, typename... Rest> struct GameEventList<First, Rest...> {
+  typedef GameEventList<Rest...> Tail;
+  static constexpr bool contains(uint8_t id) {
+    return First::id == id || Tail::contains(id);
+  }
+  static constexpr bool uniqueIds() {
+    return !Tail::contains(First::id) && Tail::uniqueIds();
+  }
+  template <typename All> static constexpr bool repliesIn() {
+    return (First::replyId == NO_REPLY_EVENT || All::contains(First::replyId)) && Tail::template repliesIn<All>();
+  }
+};
+
+typedef GameEvent<CE_START_PUZZLE,             GAME_TO_PUZZLE,     CE_PUZZLE_START_SUCCESS,    NoPayload>        StartPuzzleEvent;
+typedef GameEvent<CE_START_SUB_PUZZLE,         GAME_TO_PUZZLE,     NO_REPLY_EVENT,             NoPayload>        StartSubPuzzleEvent;
+typedef GameEvent<CE_PUZZLE_START_SUCCESS,     GAME_TO_CONTROLLER, NO_REPLY_EVENT,             NoPayload>        PuzzleStartSuccessEvent;
+typedef GameEvent<CE_RESET_NODE,               GAME_TO_ANY,        NO_REPLY_EVENT,             NoPayload>        ResetNodeEvent;
+typedef GameEvent<CE_NODE_RESET_SUCCESS,       GAME_TO_CONTROLLER, NO_REPLY_EVENT,             NoPayload>        NodeResetSuccessEvent;
+typedef GameEvent<CE_RESET_AND_START_PUZZLE,   GAME_TO_PUZZLE,     CE_RESET_AND_START_SUCCESS, NoPayload>        ResetAndStartPuzzleEvent;
+typedef GameEvent<CE_RESET_AND_START_SUCCESS,  GAME_TO_CONTROLLER, NO_REPLY_EVENT,             NoPayload>        ResetAndStartSuccessEvent;
+typedef GameEvent<CE_REQUEST_PUZZLE_STATUS,    GAME_TO_PUZZLE,     NO_REPLY_EVENT,             NoPayload>        RequestPuzzleStatusEvent;
+typedef GameEvent<CE_PUZZLE_NOT_STARTED,       GAME_TO_CONTROLLER, NO_REPLY_EVENT,             NoPayload>        PuzzleNotStartedEvent;
+typedef GameEvent<CE_PUZZLE_IN_PROGRESS,       GAME_TO_CONTROLLER, NO_REPLY_EVENT,             NoPayload>        PuzzleInProgressEvent;
+typedef GameEvent<CE_PUZZLE_COMPLETED,         GAME_TO_CONTROLLER, CE_PUZZLE_COMPLETED_SUCCESS, int>             PuzzleCompletedEvent;
+typedef GameEvent<CE_PUZZLE_COMPLETED_SUCCESS, GAME_TO_PUZZLE,     NO_REPLY_EVENT,             NoPayload>        PuzzleCompletedSuccessEvent;
+typedef GameEvent<CE_REQUEST_STATS,            GAME_TO_PUZZLE,     CE_STATS,                   int>              RequestStatsEvent;
+typedef GameEvent<CE_STATS,                    GAME_TO_CONTROLLER, NO_REPLY_EVENT,             CommStatsPayload> StatsEvent;
+typedef GameEvent<CE_REQUEST_STATE_SYNC,       GAME_TO_PUZZLE,     CE_STATE_DELTA,             NoPayload>        RequestStateSyncEvent;
+typedef GameEvent<CE_STATE_DELTA,              GAME_TO_CONTROLLER, NO_REPLY_EVENT,             BytesPayload>     StateDeltaEvent;
+typedef GameEvent<CE_DIAL_POSITION,            GAME_TO_CONTROLLER, NO_REPLY_EVENT,             int>              DialPositionEvent;
+typedef GameEvent<CE_PING,                     GAME_TO_ANY,        CE_PONG,                    NoPayload>        PingEvent;
+typedef GameEvent<CE_PONG,                     GAME_TO_ANY,        NO_REPLY_EVENT,             TextPayload>      PongEvent;
+typedef GameEvent<CE_ACK,                      GAME_TO_ANY,        NO_REPLY_EVENT,             NoPayload>        AckEvent;
+typedef GameEvent<CE_PLAY_TRACK,               GAME_TO_ANY,        CE_PLAY_TRACK_SUCCESS,      TextPayload>      PlayTrackEvent;
+typedef GameEvent<CE_PLAY_TRACK_SUCCESS,       GAME_TO_ANY,        NO_REPLY_EVENT,             NoPayload>        PlayTrackSuccessEvent;
+
+typedef GameEventList<StartPuzzleEvent, StartSubPuzzleEvent, PuzzleStartSuccessEvent, ResetNodeEvent,
+                      NodeResetSuccessEvent, ResetAndStartPuzzleEvent, ResetAndStartSuccessEvent,
+                      RequestPuzzleStatusEvent, PuzzleNotStartedEvent, PuzzleInProgressEvent, PuzzleCompletedEvent,
+                      PuzzleCompletedSuccessEvent, RequestStatsEvent, StatsEvent, RequestStateSyncEvent,
+                      StateDeltaEvent, DialPositionEvent, PingEvent, PongEvent, AckEvent, PlayTrackEvent,
+                      PlayTrackSuccessEvent> GameEventSchema;
+
+static_assert(GameEventSchema::uniqueIds(), "Two events in the schema have the same id");
+static_assert(GameEventSchema::repliesIn<GameEventSchema>(), "An event replies with an event that is not in the schema");
+static_assert(sizeof(CommStatsPayload) == 20, "CommStatsPayload is 20 bytes on the wire");
+
+// Asynchronous requests. A request is an event that expects a response event back from the node
+// it was sent to. Requests are resent from doComm() until the response arrives or the attempts
+// run out, then the callback is called. The game loop keeps running while it waits.
+#ifndef MAX_PENDING_REQUESTS
+#define MAX_PENDING_REQUESTS 3
+#endif
+#define REQUEST_MAX_ATTEMPTS 5
+
+// The request handle is the correlation id carried in the frame. 0 is never a valid handle.
+typedef uint8_t GameRequestHandle;
+#define NO_GAME_REQUEST 0
+
+// Called once per request. success is false if no response arrived. On success eventData holds the response.
+typedef void (*GameRequestCallback)(GameRequestHandle handle, bool success);
+
+struct pendingRequestStruct {
+  GameRequestHandle handle = NO_GAME_REQUEST;   // NO_GAME_REQUEST when the slot is free
+  uint8_t nodeId = 0;
+  uint8_t event = 0;
+  uint8_t responseEvent = 0;
+  uint8_t attempts = 0;
+  uint8_t sequence = 0;              // Same for every send of the request so the node can spot resends
+  uint8_t dataType = GAME_PAYLOAD_NONE;
+  uint8_t dataLength = 0;
+  uint8_t data[MAX_EVENT_DATA];      // Kept so the request can be resent
+  unsigned long sentTime = 0;
+  GameRequestCallback callback = NULL;
+};
+
+// Event handler registry. onEvent(CE_PING, handler) routes one event id straight to its handler.
+// eventHandlerIndex has one entry per event id holding the handler slot + 1, 0 if none, so the
+// lookup is a single array read. Events without a handler go to the local event handler.
+#define NUM_EVENT_IDS  (LAST_EVENT_ID - FIRST_EVENT_ID + 1)
+#ifndef MAX_EVENT_HANDLERS
+#define MAX_EVENT_HANDLERS 8
+#endif
+
+// Handlers read the received event from eventData, same as the local event handler.
+typedef void (*GameEventHandler)(void);
 
-char EventIdbuffer[2];
-char EventDataBuffer[MAX_EVENT_DATA+1]; // Max send of 20 characters, Need the +1 for the string terminator.
+uint8_t eventHandlerIndex[NUM_EVENT_IDS];
+GameEventHandler eventHandlers[MAX_EVENT_HANDLERS];
+uint8_t numEventHandlers = 0;
 
-// First character in each comm packet. Use this to validate that we have an actual beginning of a packet.
+static void (*gameEventOccurred)(void);
+
+// First character in each legacy comm packet. Use this to validate that we have an actual beginning of a packet.
 const char GAME_START_PACKET_CHAR = '^';
 
-char sendBuffer[MAX_EVENT_DATA];
+char sendBuffer[GAME_MAX_FRAME_LENGTH];
+
+// The batch of events waiting to go to batchNode. batchBuffer[0] is filled in with the marker when it is sent.
+char batchBuffer[GAME_MAX_BATCH_LENGTH];
+int batchNode = 0;
+uint8_t batchLength = 0;
+uint8_t batchEventCount = 0;
+uint8_t batchPriority = GAME_PRIORITY_TELEMETRY;   // Highest class of the events in the batch
+unsigned int batchExpireMillis = GAME_NEVER_EXPIRE; // Longest expiry of the events in the batch
+unsigned long batchStartTime = 0;
+unsigned long batchWindow = GAME_COMM_BATCH_WINDOW;
+
+// Frames waiting for room in PJON's packet buffer, one FIFO per destination node. Frames are handed
+// to PJON round robin across the destinations with at most OUTBOUND_MAX_IN_FLIGHT packets per node,
+// so a node that does not answer only holds up its own frames while PJON retries them.
+#ifndef OUTBOUND_QUEUE_SLOTS
+#define OUTBOUND_QUEUE_SLOTS 4
+#endif
+#ifndef MAX_OUTBOUND_DESTINATIONS
+#define MAX_OUTBOUND_DESTINATIONS 3
+#endif
+#ifndef OUTBOUND_MAX_IN_FLIGHT
+#define OUTBOUND_MAX_IN_FLIGHT 1
+#endif
+#define NO_OUTBOUND_SLOT 0xFF
+
+struct outboundFrameStruct {
+  uint8_t length = 0;                  // 0 if the slot is free
+  uint8_t priority = GAME_PRIORITY_GAME;
+  bool expires = false;
+  unsigned long expireTime = 0;        // millis() the frame expires at, if expires is set
+  uint8_t next = NO_OUTBOUND_SLOT;     // Next frame for the same node, in priority order
+  char frame[GAME_MAX_BATCH_LENGTH];   // Big enough for any frame, batches included
+};
+
+struct outboundQueueStruct {
+  uint8_t nodeId = 0;                  // 0 if the queue is empty and free
+  uint8_t head = NO_OUTBOUND_SLOT;
+  uint8_t tail = NO_OUTBOUND_SLOT;
+};
+
+outboundFrameStruct outboundFrames[OUTBOUND_QUEUE_SLOTS];
+unsigned int priorityExpireMillis[] = { GAME_NEVER_EXPIRE, GAME_NEVER_EXPIRE, GAME_AUDIO_EXPIRE_MILLIS,
+                                        GAME_TELEMETRY_EXPIRE_MILLIS };
+outboundQueueStruct outboundQueues[MAX_OUTBOUND_DESTINATIONS];
+uint8_t nextOutboundQueue = 0;         // Queue to look at first on the next admission
 
+#ifdef GAME_COMM_SEND_LEGACY_FRAMES
 char padBuffer[MAX_EVENT_DATA];
 
 char intDataBuffer[MAX_EVENT_DATA];
+#endif
 
 int thisNode;
 
 eventDataStruct eventData;     // This will be filled after an event is received
-unsigned int responseWaitTime = 10000;  // We will wait 10 seconds for a response
-bool eventSentSuccessfully = false;  // used for events that need a response. START and COMPLETE mostly
-int importantEventResponse = 0;  // The important event response we are waiting to receive
-
-// PJON object
-PJON<SoftwareBitBang> bus;
-
-// Local funtions
-void processSend();
-void processReceive();
 
+// Received events wait here between the PJON receive callback and their handlers.
+#ifndef RECEIVED_EVENT_QUEUE_SIZE
+#define RECEIVED_EVENT_QUEUE_SIZE 4    // Must be a power of 2
+#endif
+#define RECEIVED_EVENT_QUEUE_MASK (RECEIVED_EVENT_QUEUE_SIZE - 1)
+#if GAME_MAX_BATCH_EVENTS > RECEIVED_EVENT_QUEUE_SIZE
+#error "GAME_MAX_BATCH_EVENTS must not be more than RECEIVED_EVENT_QUEUE_SIZE"
+#endif
 
+eventDataStruct receivedEvents[RECEIVED_EVENT_QUEUE_SIZE];
+uint8_t receivedEventHead = 0;
+uint8_t receivedEventCount = 0;
+unsigned int receivedEventsDropped = 0;   // Events lost because the queue was full, from all senders
+
+// PJON acknowledges a frame before it is handed over, so a frame is always taken. One whose events do
+// not fit in the queue waits here undecoded until they do, and no frame is received meanwhile so the
+// events keep their order.
+#define HELD_FRAME_LENGTH (GAME_MAX_BATCH_LENGTH > GAME_MAX_FRAME_LENGTH ? GAME_MAX_BATCH_LENGTH : GAME_MAX_FRAME_LENGTH)
+uint8_t heldFrame[HELD_FRAME_LENGTH];
+uint8_t heldFrameLength = 0;             // 0 if no frame is held
+uint8_t heldFrameSender = 0;
+#ifdef DO_COMM_UTILS_DEBUG
+unsigned int reportedEventsDropped = 0;
+#endif
+bool dispatchingEvent = false;
+unsigned int responseWaitTime = 3000;  // We will wait 3 seconds for a response before resending a request
+
+// Requests are numbered by their sender. The receiver remembers the last SEQUENCE_WINDOW_SIZE numbers
+// it saw from each sender, so a resent request is answered from the reply it already sent instead of
+// being handled a second time. Resending is then safe and responseWaitTime can stay short. A node
+// needs a window for every node that sends it requests: a window is only reused once its sender has
+// been quiet for GAME_SEQUENCE_EXPIRE_MILLIS, requests from another sender are dropped until then.
+#ifndef MAX_SEQUENCE_SENDERS
+#define MAX_SEQUENCE_SENDERS 2
+#endif
+#define SEQUENCE_WINDOW_SIZE 16
+// A sender not heard from for this long starts a new window. Longer than a request keeps resending.
+#ifndef GAME_SEQUENCE_EXPIRE_MILLIS
+#define GAME_SEQUENCE_EXPIRE_MILLIS 30000
+#endif
 
-void eventReceivedFromController(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packet_info) {
+struct sequenceWindowStruct {
+  uint8_t nodeId = 0;                // 0 if the entry is free
+  uint8_t bootEpoch = 0;             // The sender's numbering starts over when this changes
+  uint8_t highestSequence = 0;
+  uint16_t window = 0;               // Bit n set if highestSequence - n has been seen
+  unsigned long lastSeen = 0;
+  uint8_t replySequence = 0;         // The request the cached reply answers
+  uint8_t replyCorrelation = 0;
+  uint8_t replyLength = 0;           // 0 until the reply has been sent
+  char reply[GAME_MAX_FRAME_LENGTH];
+};
 
-#ifdef DO_COMM_UTILS_DEBUG
-  Serial.print(F("--RECV len: "));
-  Serial.print(length);
-  if (length > 0) {
-    Serial.print(F(", Char0: "));
-    Serial.print((char)payload[0]);
-  }
-  Serial.print(F(", SenderID: "));
-  Serial.println(packet_info.sender_id);
+sequenceWindowStruct sequenceWindows[MAX_SEQUENCE_SENDERS];
+uint8_t lastSequence = 0;
+// Drawn at start up and sent with every sequence number. A node that restarts numbers its requests
+// from 1 again, the new epoch tells the receivers to forget the numbers they saw before.
+uint8_t bootEpoch = 0;
+uint16_t duplicatesSuppressed = 0;       // Resent requests that were not handled again
+uint16_t sequenceWindowsFull = 0;        // Requests dropped because no window was free for their sender
+
+pendingRequestStruct pendingRequests[MAX_PENDING_REQUESTS];
+GameRequestHandle lastRequestHandle = NO_GAME_REQUEST;
+
+// Comm statistics, one entry per node this node has talked to. Sent to anyone asking with
+// CE_REQUEST_STATS. Counters stop at their maximum instead of wrapping.
+#ifndef MAX_COMM_STATS_NODES
+#define MAX_COMM_STATS_NODES 4
 #endif
 
-  if (length == MAX_EVENT_DATA && ((char)payload[0]) == GAME_START_PACKET_CHAR) {
+struct commStatsStruct {
+  uint8_t nodeId = 0;              // 0 if the entry is free
+  uint16_t framesSent = 0;         // Frames handed to PJON for the node
+  uint16_t attempts = 0;           // PJON send attempts, retries included
+  uint16_t naks = 0;
+  uint16_t connectionLost = 0;
+  uint16_t bufferFull = 0;         // Frames dropped for lack of room, pushed out ones included
+  uint16_t junkReceived = 0;       // Frames from the node that could not be decoded
+  uint16_t eventsDropped = 0;      // Events from the node that found the received event queue full
+  uint16_t expired = 0;            // Frames dropped because they were too old to be worth delivering
+  uint16_t rttMin = 0;             // Request round trip, milliseconds
+  uint16_t rttMax = 0;
+  uint16_t rttCount = 0;
+  uint32_t rttTotal = 0;
+};
 
-    eventData.sentFrom=packet_info.sender_id;
+commStatsStruct commStats[MAX_COMM_STATS_NODES];
 
-    EventIdbuffer[0] = (char)payload[1];
-    EventIdbuffer[1] = (char)payload[2];
-    eventData.event = atoi(EventIdbuffer);
+void countStat(uint16_t &counter) {
+  if (counter != 0xFFFF) {
+    counter++;
+  }
+}
 
-    for(uint8_t i=3; i<length; i++)  {
-	  if((char)payload[i] == ' ') {
-	    EventDataBuffer[i-3] = 0;      // Put a null and break out
-        break; 
-	  } else {
-        EventDataBuffer[i-3] = (char)payload[i];
-	  }
+/**
+ * Stats entry for nodeId, taking a free entry the first time. NULL if the table is full.
+ */
+commStatsStruct *findCommStats(uint8_t nodeId) {
+  commStatsStruct *freeEntry = NULL;
+  for (uint8_t i=0; i<MAX_COMM_STATS_NODES; i++) {
+    if (commStats[i].nodeId == nodeId) {
+      return &commStats[i];
     }
-    EventDataBuffer[length-3] = 0;      // I think this is unnecessary but doesn't hurt anything
-    strcpy(eventData.data, EventDataBuffer);
-	
-	if(importantEventResponse > 0 && eventData.event == importantEventResponse) {
-	     eventSentSuccessfully = true;
-	} else {	
-       gameEventOccurred();
-	}
+    if (freeEntry == NULL && commStats[i].nodeId == 0) {
+      freeEntry = &commStats[i];
+    }
+  }
+  if (freeEntry != NULL) {
+    freeEntry->nodeId = nodeId;
+  }
+  return freeEntry;
+}
 
+void recordRoundTrip(uint8_t nodeId, unsigned long rtt) {
+  commStatsStruct *stats = findCommStats(nodeId);
+  if (stats == NULL) {
+    return;
+  }
+  uint16_t rttMillis = (rtt > 0xFFFF) ? 0xFFFF : rtt;
+  if (stats->rttCount == 0 || rttMillis < stats->rttMin) {
+    stats->rttMin = rttMillis;
+  }
+  if (rttMillis > stats->rttMax) {
+    stats->rttMax = rttMillis;
+  }
+  if (stats->rttCount == 0xFFFF) {
+    // Keep the average moving instead of freezing it
+    stats->rttTotal -= stats->rttTotal / stats->rttCount;
   } else {
-#ifdef DO_COMM_UTILS_DEBUG
-    Serial.print(F("--RECV junk, length: "));
-    Serial.println(length);
-#endif
+    stats->rttCount++;
   }
+  stats->rttTotal += rttMillis;
 }
 
-
-void doComm() {
-  processSend();
-  processReceive();
+void clearCommStats() {
+  for (uint8_t i=0; i<MAX_COMM_STATS_NODES; i++) {
+    commStats[i] = commStatsStruct();
+  }
 }
 
-void processSend() {
-  uint8_t numToSend = bus.update();
-//#ifdef DO_COMM_UTILS_DEBUG
-//  if (numToSend > 0) {
-//    Serial.print("~~ProcSend: ");
-//    Serial.println(numToSend);
-//  }
-//#endif
-}
+// Puzzle state mirroring. A puzzle describes where its game is in up to MAX_STATE_FIELDS 16 bit
+// fields (pots on readers, attempts, sequence position...) with setStateField(). doComm() pushes
+// the fields that changed to the controller in one CE_STATE_DELTA, at most every stateDeltaInterval,
+// so a burst of changes goes out as one delta. Every delta has the next version number. The
+// controller keeps a puzzleStateMirrorStruct per puzzle and asks for the whole record with
+// CE_REQUEST_STATE_SYNC when it misses one.
+//
+// CE_STATE_DELTA payload:
+//   [0]  Version
+//   [1]  Flags, STATE_DELTA_FULL if every field is included
+//   [2]  Field mask, bit n set if field n is included
+//   [3-] The included fields in field order, 16 bits each, low byte first
+#define MAX_STATE_FIELDS 8      // One bit each in the field mask
+#ifndef GAME_STATE_DELTA_MILLIS
+#define GAME_STATE_DELTA_MILLIS 250
+#endif
+#define STATE_DELTA_FULL        0x01
+#define STATE_DELTA_HEADER_LENGTH 3
+#define STATE_SYNC_RETRY_MILLIS 1000   // Least time between two sync requests to the same puzzle
+
+uint16_t stateFields[MAX_STATE_FIELDS];
+uint8_t stateFieldsUsed = 0;           // Fields that have ever been set
+uint8_t stateDirtyMask = 0;            // Fields changed since the last delta
+uint8_t stateVersion = 0;
+bool stateFullPending = true;          // The next delta holds every field. The first one always does.
+unsigned long lastStateDeltaTime = 0;
+unsigned int stateDeltaInterval = GAME_STATE_DELTA_MILLIS;
+
+struct puzzleStateMirrorStruct {
+  uint8_t nodeId = 0;                  // 0 if the entry is free
+  bool synced = false;                 // Holds a full record and every delta since
+  uint8_t version = 0;
+  uint8_t fieldMask = 0;               // Fields the puzzle has reported
+  uint16_t fields[MAX_STATE_FIELDS];
+  unsigned long lastUpdate = 0;
+  unsigned long syncRequestTime = 0;
+};
 
-void processReceive() {
-  uint16_t recvState = bus.receive(commUtilsReceiveTimeout);
-//#ifdef DO_COMM_UTILS_DEBUG
-//  if (ACK == recvState) {
-//    Serial.println(F("**ProcRecv: ACK"));
-//  }
-//  else if (NAK == recvState) {
-//    Serial.println(F("**ProcRecv: NAK"));
-//  }
-//#endif
-}
+// Events from interrupt handlers. An ISR must not touch the comm buffers or PJON, so it only stores
+// the event with queueEventFromISR(), which takes a few cycles and never blocks, and doComm() sends
+// it from the main loop. The queue has a single producer and a single consumer: only the ISR moves
+// isrEventHead and only doComm() moves isrEventTail. Both are single bytes, so neither side has to
+// turn interrupts off. AVR interrupts do not nest, so all the ISRs of a sketch count as one producer.
+#ifndef ISR_EVENT_QUEUE_SLOTS
+#define ISR_EVENT_QUEUE_SLOTS 8        // Must be a power of 2, at most 128
+#endif
+#define ISR_EVENT_QUEUE_MASK (ISR_EVENT_QUEUE_SLOTS - 1)
+static_assert((ISR_EVENT_QUEUE_SLOTS & ISR_EVENT_QUEUE_MASK) == 0 && ISR_EVENT_QUEUE_SLOTS <= 128,
+              "ISR_EVENT_QUEUE_SLOTS must be a power of 2, at most 128");
+
+struct isrEventStruct {
+  uint8_t nodeId;
+  uint8_t eventId;
+  int value;
+};
 
+volatile isrEventStruct isrEvents[ISR_EVENT_QUEUE_SLOTS];
+volatile uint8_t isrEventHead = 0;         // Next slot the ISR fills. Only written by the ISR.
+volatile uint8_t isrEventTail = 0;         // Next slot doComm() sends. Only written by doComm().
+volatile uint8_t isrEventsDropped = 0;     // Events the ISR found no room for. Only written by the ISR.
+uint8_t isrEventsDroppedReported = 0;
+
+// Values from interrupt handlers where only the newest one is worth sending, like the position of a
+// wheel that turns faster than the bus should carry every step. The ISR overwrites the value of its
+// slot with setLatestFromISR() and then moves the slot's version. doComm() sends the newest value
+// once for every change, so a burst of steps between two doComm() passes is one event. If the ISR
+// writes while doComm() copies the value, the version has moved and doComm() copies it again.
+#ifndef ISR_LATEST_SLOTS
+#define ISR_LATEST_SLOTS 2
+#endif
+// The next value replaces a latest value that is still undelivered, so an old one is not retried long
+#ifndef GAME_LATEST_EXPIRE_MILLIS
+#define GAME_LATEST_EXPIRE_MILLIS 500
+#endif
 
+struct isrLatestStruct {
+  uint8_t nodeId;
+  uint8_t eventId;                   // 0 if the slot is free
+  int value;
+  uint8_t version;                   // Only written by the ISR
+  uint8_t sentVersion;               // Only written by doComm()
+};
 
+volatile isrLatestStruct isrLatest[ISR_LATEST_SLOTS];
 
-/**
- * Send an Event to the specified Node.
- */
-void sendEventToNode(int nodeId, int eventId, String gameData) {
-    
+// PJON object
+PJON<GAME_COMM_STRATEGY> bus;
 
+// Priority class and expiry of the frame in each of PJON's packets
+uint8_t busPacketPriority[sizeof(bus.packets) / sizeof(bus.packets[0])];
+bool busPacketExpires[sizeof(bus.packets) / sizeof(bus.packets[0])];
+unsigned long busPacketExpireTime[sizeof(bus.packets) / sizeof(bus.packets[0])];
+bool busPacketsExpire = false;                 // Some packet in PJON may expire,
+unsigned long nextBusPacketExpireTime = 0;     // none of them before this millis()
 
-#ifdef DO_COMM_UTILS_DEBUG
-//  Serial.print(F("++INPUT: "));
-//  Serial.println(gameData);
-#endif
+// Local funtions
+void processReceivedEvents();
+void processBatch();
+void dispatchEvent();
+void processSend();
+uint32_t processReceive(uint32_t maxMicros);
+void processPendingRequests();
+bool completePendingRequest();
+void processStateDelta();
+void processIsrEvents();
+void admitOutboundFrames();
+bool acceptSequencedEvent();
+void cacheSequencedReply(int nodeId, uint8_t frameLen);
 
-  // First character is the Game Comm Packet Start Character
-  // Character 2 and 3 are event ID. To make it easy only support event ID values
-  // of 10 - 99.
-  // Characters 4-20 are data.
-  if (eventId >= 10 && eventId <= 99 && gameData.length() <= (MAX_EVENT_DATA-3) ) {
-    sendBuffer[0] = GAME_START_PACKET_CHAR;
-    itoa(eventId, &sendBuffer[1], 10);
-    memcpy(&sendBuffer[3], gameData.c_str(), gameData.length());
 
-    int dataLen = gameData.length() + 3;
-    if (dataLen < MAX_EVENT_DATA) {
-      memcpy(&sendBuffer[dataLen], padBuffer, MAX_EVENT_DATA - dataLen);
-    }
 
-#ifdef DO_COMM_UTILS_DEBUG
-    Serial.print(F("++SEND NodeId: "));
-    Serial.print(nodeId);
-    Serial.print(F(" EventId: "));
-    Serial.print(eventId);
-    Serial.print(F(" ["));
-    for (byte ii=0; ii<MAX_EVENT_DATA; ii++) {
-      Serial.print((char) sendBuffer[ii]);
-    }
-    Serial.println(F("]"));
-#endif
+/**
+ * Decode the old fixed length ASCII frame: '^', two event id digits, data padded with spaces.
+ */
+bool decodeLegacyFrame(uint8_t *payload, uint16_t length, eventDataStruct &event) {
+  if (length != MAX_EVENT_DATA || ((char)payload[0]) != GAME_START_PACKET_CHAR ||
+      payload[1] < '0' || payload[1] > '9' || payload[2] < '0' || payload[2] > '9') {
+    return false;
+  }
 
-    // Always send a full packet - then we know we have always received a full packet.
-    bus.send(nodeId, sendBuffer, MAX_EVENT_DATA);
-    processSend();
-	
-  } else {
-#ifdef DO_COMM_UTILS_DEBUG
-    Serial.println(F("Bad request in commUtils"));
-#endif
+  event.event = (payload[1] - '0') * 10 + (payload[2] - '0');
+
+  uint8_t dataLen = 0;
+  while (dataLen < (length - 3) && (char)payload[dataLen + 3] != ' ') {
+    event.data[dataLen] = (char)payload[dataLen + 3];
+    dataLen++;
   }
+  event.data[dataLen] = 0;
+  event.dataLength = dataLen;
+  event.dataType = (dataLen > 0) ? GAME_PAYLOAD_STRING : GAME_PAYLOAD_NONE;
+  event.intData = 0;
+  event.correlationId = 0;
+  event.sequence = 0;
+  event.bootEpoch = 0;
+  return true;
 }
 
-
 /**
- * Send an event to the game controller
+ * Id of a received event in the current numbering. Nodes with the old GameCommUtils send
+ * CE_PUZZLE_COMPLETED_SUCCESS with the id of CE_RESET_AND_START_SUCCESS. Only the controller sends the
+ * first and it never sends the second, so that id from the controller is the completion reply.
  */
-void sendEventToController(int eventId, String gameData) {
-  sendEventToNode(GAME_CONTROLLER_NODE,eventId, gameData);
+uint8_t currentEventId(uint8_t eventId, uint8_t senderId) {
+  if (eventId == CE_OLD_PUZZLE_COMPLETED_SUCCESS && senderId == GAME_CONTROLLER_NODE) {
+    return CE_PUZZLE_COMPLETED_SUCCESS;
+  }
+  return eventId;
 }
 
 /**
- * Send an Event where the data is an integer.
+ * Length of the binary record (a frame without its marker byte) at record, 0 if it is not valid.
  */
-void sendIntEventToNode(int nodeId, int eventId, int intGameData) {
-  itoa(intGameData, &intDataBuffer[0], 10);
-  sendEventToNode(nodeId, eventId, intDataBuffer);
+uint8_t binaryRecordLength(const uint8_t *record, uint16_t length) {
+  if (length < GAME_FRAME_HEADER_LENGTH - 1) {
+    return 0;
+  }
+  uint8_t dataType = record[1] & GAME_PAYLOAD_TYPE_MASK;
+  uint8_t dataLen = record[2];
+  uint8_t recordLen = GAME_FRAME_HEADER_LENGTH - 1 + dataLen;
+  if (record[1] & GAME_FRAME_FLAG_CORRELATION) {
+    recordLen++;
+  }
+  if (record[1] & GAME_FRAME_FLAG_SEQUENCE) {
+    recordLen += 2;
+  }
+  if (dataLen > MAX_EVENT_DATA || length < recordLen || (dataType == GAME_PAYLOAD_INT && dataLen != 2)) {
+    return 0;
+  }
+  return recordLen;
 }
 
-void sendPuzzleCompleteEvent(int fromNode) {
-  itoa(fromNode, &intDataBuffer[0], 10);
-  sendEventToNode(GAME_CONTROLLER_NODE,CE_PUZZLE_COMPLETED, intDataBuffer);
-
-}
-
-void sendControllerImportantEvent(int theEvent, int responseEvent, int fromNode) {
-   unsigned long startTime;
-   unsigned int numberOfRetrys = 0;
-   
-   importantEventResponse = responseEvent;
-   
-   itoa(fromNode, &intDataBuffer[0], 10);
-   eventSentSuccessfully = false;
-   while(!eventSentSuccessfully && numberOfRetrys < 5) {
-     numberOfRetrys++;
-     if(numberOfRetrys > 1) {
-        Serial.println(F("RESENDING Important EVENT AS NO RESPONSE RECEIVED"));
-     }
-     sendEventToNode(GAME_CONTROLLER_NODE,theEvent, intDataBuffer);
-     // now wait a specified time for a response
-     startTime = millis();
-     while(millis()-startTime < responseWaitTime && !eventSentSuccessfully) {
-        doComm();
-     }
-     Serial.println(F("Finished Sending Important Event"));
-   }
+/**
+ * Decode a binary record that binaryRecordLength() has accepted.
+ */
+void decodeBinaryRecord(const uint8_t *record, eventDataStruct &event) {
+  uint8_t dataType = record[1] & GAME_PAYLOAD_TYPE_MASK;
+  uint8_t dataLen = record[2];
+  uint8_t dataStart = GAME_FRAME_HEADER_LENGTH - 1;
+
+  event.event = record[0];
+  event.dataType = dataType;
+  event.dataLength = dataLen;
+  event.intData = 0;
+  event.correlationId = 0;
+  event.sequence = 0;
+  event.bootEpoch = 0;
+  if (record[1] & GAME_FRAME_FLAG_CORRELATION) {
+    event.correlationId = record[dataStart++];
+  }
+  if (record[1] & GAME_FRAME_FLAG_SEQUENCE) {
+    event.bootEpoch = record[dataStart++];
+    event.sequence = record[dataStart++];
+  }
+
+  if (dataType == GAME_PAYLOAD_INT) {
+    event.intData = (int16_t)(record[dataStart] | (record[dataStart + 1] << 8));
+    // Keep the text form for the handlers that atoi() the data.
+    itoa(event.intData, event.data, 10);
+  } else {
+    memcpy(event.data, &record[dataStart], dataLen);
+    event.data[dataLen] = 0;
+  }
 }
 
-void sendPuzzleStartSuccess() {
-     sendEventToNode(GAME_CONTROLLER_NODE,CE_PUZZLE_START_SUCCESS, "");
+/**
+ * Decode a binary frame. See GAME_FRAME_V1 for the layout.
+ */
+bool decodeBinaryFrame(uint8_t *payload, uint16_t length, eventDataStruct &event) {
+  if (length < GAME_FRAME_HEADER_LENGTH || payload[0] != GAME_FRAME_V1 ||
+      binaryRecordLength(&payload[1], length - 1) == 0) {
+    return false;
+  }
+  decodeBinaryRecord(&payload[1], event);
+  return true;
 }
 
+/**
+ * Next free entry of the received event queue, NULL (and counted as dropped against senderId) if the
+ * queue is full. The entry only becomes part of the queue when receivedEventCount is incremented.
+ */
+eventDataStruct *reserveReceivedEvent(uint8_t senderId) {
+  if (receivedEventCount == RECEIVED_EVENT_QUEUE_SIZE) {
+    receivedEventsDropped++;
+    commStatsStruct *stats = findCommStats(senderId);
+    if (stats != NULL) {
+      countStat(stats->eventsDropped);
+    }
+    return NULL;
+  }
+  return &receivedEvents[(receivedEventHead + receivedEventCount) & RECEIVED_EVENT_QUEUE_MASK];
+}
 
+/**
+ * Queue every record of a batch frame, in order.
+ */
+void receiveBatchFrame(uint8_t *payload, uint16_t length, uint8_t senderId) {
+  uint16_t offset = 1;
+  while (offset < length) {
+    uint8_t recordLen = binaryRecordLength(&payload[offset], length - offset);
+    if (recordLen == 0) {
+      commStatsStruct *stats = findCommStats(senderId);
+      if (stats != NULL) {
+        countStat(stats->junkReceived);
+      }
+#ifdef DO_COMM_UTILS_DEBUG
+      Serial.print(F("--RECV junk in batch at: "));
+      Serial.println(offset);
+#endif
+      return;
+    }
+    eventDataStruct *event = reserveReceivedEvent(senderId);
+    if (event != NULL) {
+      decodeBinaryRecord(&payload[offset], *event);
+      event->event = currentEventId(event->event, senderId);
+      event->sentFrom = senderId;
+      receivedEventCount++;
+    }
+    offset += recordLen;
+  }
+}
 
 /**
- *
+ * Number of events a frame queues.
  */
-void respondSuccessToSender() {
-  int returnEvent = CE_ACK;
- 
-  
-  switch(eventData.event) {
-     case CE_PLAY_TRACK:
-	   returnEvent = CE_PLAY_TRACK_SUCCESS;
-	 break;
+uint8_t frameEventCount(const uint8_t *payload, uint16_t length) {
+  if (length == 0 || payload[0] != GAME_FRAME_BATCH) {
+    return 1;
   }
-  Serial.println(F("Sending Success Response"));
-   sendEventToNode(eventData.sentFrom, returnEvent, "");
-   processSend();
+  uint8_t count = 0;
+  uint16_t offset = 1;
+  while (offset < length) {
+    uint8_t recordLen = binaryRecordLength(&payload[offset], length - offset);
+    if (recordLen == 0) {
+      break;
+    }
+    count++;
+    offset += recordLen;
+  }
+  return count;
 }
 
 /**
- * PACKETS_BUFFER_FULL - Possible wrong bus configuration. Higher MAX_PACKETS in PJON.h if necessary.
+ * Decode a frame into the received event queue.
  */
-void error_handler(uint8_t code, uint8_t data) {
-  if(code == PJON_CONNECTION_LOST) {
-    Serial.print(F("Connection with device ID "));
-    Serial.print(bus.packets[data].content[0], DEC);
-    Serial.println(F(" is lost."));
+void queueFrameEvents(uint8_t *payload, uint16_t length, uint8_t senderId) {
+
+  if (length > 0 && payload[0] == GAME_FRAME_BATCH) {
+    receiveBatchFrame(payload, length, senderId);
+    return;
   }
-  if(code == PJON_PACKETS_BUFFER_FULL) {
-    Serial.print(F("Packet buffer full, length: "));
-    Serial.println(data, DEC);
+
+  eventDataStruct *event = reserveReceivedEvent(senderId);
+  if (event == NULL) {
+    return;
   }
-  if(code == PJON_CONTENT_TOO_LONG) {
-    Serial.print(F("Content too long, length: "));
-    Serial.println(data);
+  if (length > 0 && (decodeBinaryFrame(payload, length, *event) || decodeLegacyFrame(payload, length, *event))) {
+    event->event = currentEventId(event->event, senderId);
+    event->sentFrom = senderId;
+    receivedEventCount++;
+  } else {
+    commStatsStruct *stats = findCommStats(senderId);
+    if (stats != NULL) {
+      countStat(stats->junkReceived);
+    }
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.print(F("--RECV junk, length: "));
+    Serial.println(length);
+#endif
   }
 }
 
-void setLocalEventHandler(void (*function)()) {
-  gameEventOccurred = function;
+/**
+ * Whether a frame can be received now. It can unless a frame is held, any other one is taken whether
+ * its events fit in the queue or not.
+ */
+bool readyToReceive() {
+  return heldFrameLength == 0;
 }
 
-void setLocalErrorHandler(void (*function)(uint8_t, uint8_t)) {
-  bus.set_error(function);
+/**
+ * Queue the events of the held frame if they fit now.
+ */
+void releaseHeldFrame() {
+  if (heldFrameLength == 0 ||
+      frameEventCount(heldFrame, heldFrameLength) > RECEIVED_EVENT_QUEUE_SIZE - receivedEventCount) {
+    return;
+  }
+  queueFrameEvents(heldFrame, heldFrameLength, heldFrameSender);
+  heldFrameLength = 0;
 }
 
+/**
+ * PJON receive callback. Only decodes the frame into the received event queue, the handlers are called
+ * later from doComm(). Keeping this short keeps the asynchronous acknowledge timing tight. A frame
+ * whose events do not fit yet is held, one with more events than the queue holds is queued as far as
+ * it fits.
+ */
+void eventReceivedFromController(uint8_t *payload, uint16_t length, const PJON_Packet_Info &packet_info) {
+  uint8_t events = frameEventCount(payload, length);
+  if (events > RECEIVED_EVENT_QUEUE_SIZE - receivedEventCount && events <= RECEIVED_EVENT_QUEUE_SIZE &&
+      heldFrameLength == 0 && length <= HELD_FRAME_LENGTH) {
+    memcpy(heldFrame, payload, length);
+    heldFrameLength = length;
+    heldFrameSender = packet_info.sender_id;
+    return;
+  }
+  queueFrameEvents(payload, length, packet_info.sender_id);
+}
 
 /**
- * INIT Method
- * Use initCommunications() if you are fine using the default COMM pin which is defined by COMM_PIN.
- * Some shields (like the music maker shield) may use the default COMM_PIN for other things in which
- * case that node should use the initOverrideComm() and pass in the pin that it wants to use.
- * All nodes do not need to use the same pin fortunately.
+ * Hand the queued events to the game, oldest first. Each one is copied to eventData for its handler.
+ * A handler that calls doComm() again only receives, the rest of the queue waits until it returns so
+ * eventData never changes under a running handler.
  */
-void initOverrideComm(int nodeAddress, int commAddress) {
+void processReceivedEvents() {
+  if (dispatchingEvent) {
+    return;
+  }
+  dispatchingEvent = true;
 
-  // Initialize the pad buffer.
-  for (byte ii=0; ii<MAX_EVENT_DATA; ii++) {
-    padBuffer[ii] = ' ';
+#ifdef DO_COMM_UTILS_DEBUG
+  if (receivedEventsDropped != reportedEventsDropped) {
+    Serial.print(F("--RECV queue full, dropped: "));
+    Serial.println(receivedEventsDropped);
+    reportedEventsDropped = receivedEventsDropped;
   }
+#endif
 
-  thisNode = nodeAddress;
-  bus.set_id(nodeAddress);
-  bus.set_shared_network(false);
-  bus.strategy.set_pin(commAddress);
+  releaseHeldFrame();
+  while (receivedEventCount > 0) {
+    eventData = receivedEvents[receivedEventHead];
+    receivedEventHead = (receivedEventHead + 1) & RECEIVED_EVENT_QUEUE_MASK;
+    receivedEventCount--;
+    releaseHeldFrame();
 
-// Set the Async ACK flag
-#if(INCLUDE_ASYNC_ACK)
-  bus.set_asynchronous_acknowledge(true);
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.print(F("--RECV event: "));
+    Serial.print(eventData.event);
+    Serial.print(F(", SenderID: "));
+    Serial.println(eventData.sentFrom);
 #endif
 
-  //bus.set_synchronous_acknowledge(true);
+    if (eventData.sequence != 0 && !acceptSequencedEvent()) {
+      continue;
+    }
 
-  bus.begin();
-  bus.set_receiver(eventReceivedFromController);
-  bus.set_error(error_handler);
-  bus.include_sender_info(true);
+    // Responses to our own requests are consumed here, everything else goes to its handler.
+    if (!completePendingRequest()) {
+      dispatchEvent();
+    }
+  }
 
+  dispatchingEvent = false;
 }
 
-void initCommunications(int nodeAddress) {
-  initOverrideComm(nodeAddress, COMM_PIN);
-}
+
+/**
+ * Send, receive and dispatch. Listens for at most maxMicros but returns early when the bus is quiet.
+ * Returns the number of microseconds used.
+ */
+uint32_t doComm(uint32_t maxMicros) {
+  uint32_t start = micros();
+  processIsrEvents();
+  processBatch();
+  processSend();
+  uint32_t used = (uint32_t)(micros() - start);
+  processReceive(used < maxMicros ? maxMicros - used : 0);
+  processReceivedEvents();
+  processPendingRequests();
+  processStateDelta();
+  return (uint32_t)(micros() - start);
+}
+
+void doComm() {
+  doComm(commUtilsReceiveTimeout);
+}
+
+/**
+ * doComm() as a scheduler task. Register it with schedulePeriodic(0, commTask) so it runs on every pass.
+ */
+void commTask(int arg) {
+  doComm();
+}
+
+/**
+ * Note that a packet in PJON expires at expireTime, so processSend() looks for it then.
+ */
+void noteBusPacketExpiry(unsigned long expireTime) {
+  if (!busPacketsExpire || (long)(expireTime - nextBusPacketExpireTime) < 0) {
+    nextBusPacketExpireTime = expireTime;
+    busPacketsExpire = true;
+  }
+}
+
+/**
+ * Remove the packets in PJON that have expired, and note when the next of the others expires.
+ */
+void removeExpiredBusPackets() {
+  unsigned long now = millis();
+  busPacketsExpire = false;
+  for (uint8_t i=0; i<sizeof(bus.packets) / sizeof(bus.packets[0]); i++) {
+    if (bus.packets[i].state == 0 || !busPacketExpires[i]) {
+      continue;
+    }
+    if ((long)(now - busPacketExpireTime[i]) < 0) {
+      noteBusPacketExpiry(busPacketExpireTime[i]);
+      continue;
+    }
+    // An expired packet is removed quietly, it is not a lost connection.
+    commStatsStruct *stats = findCommStats(bus.packets[i].content[0]);
+    if (stats != NULL) {
+      countStat(stats->expired);
+    }
+    bus.remove(i);
+  }
+}
+
+/**
+ * PJON reports every attempt to send one of its packets here, it is counted against the packet's
+ * receiver. The asynchronous acknowledgments PJON sends on its own are left out, like in framesSent.
+ */
+void countSendAttempt(uint16_t packet, uint16_t response) {
+  const char *content = bus.packets[packet].content;
+  if (bus.packets[packet].length == bus.packet_overhead(content[1])) {
+    return;
+  }
+  commStatsStruct *stats = findCommStats(content[0]);
+  if (stats == NULL) {
+    return;
+  }
+  countStat(stats->attempts);
+  if (response == PJON_NAK) {
+    countStat(stats->naks);
+  }
+}
+
+/**
+ * Let PJON send what it has. Attempts and NAKs come from PJON through countSendAttempt(), and the
+ * packets are only looked at for expiry once the first of them is due, so a pass with nothing due to
+ * send or expire does not go through PJON's packets.
+ */
+void processSend() {
+  if (busPacketsExpire && (long)(millis() - nextBusPacketExpireTime) >= 0) {
+    removeExpiredBusPackets();
+  }
+
+  bus.update();
+
+  // Packets that are done made room for queued frames.
+  admitOutboundFrames();
+}
+
+/**
+ * Listen for frames for up to maxMicros. A receive attempt that fails right away means there was no
+ * carrier. One that returns anything else, or took longer than a bit to fail, saw the line busy and
+ * restarts the quiet interval. Stops listening while a frame is held for room in the received event
+ * queue, a frame sent meanwhile gets no answer and PJON sends it again later instead of it being
+ * acknowledged and dropped. Returns the number of microseconds spent.
+ */
+uint32_t processReceive(uint32_t maxMicros) {
+  uint32_t start = micros();
+  uint32_t lastActivity = start;
+  uint32_t now = start;
+  do {
+    if (!readyToReceive()) {
+      break;
+    }
+    uint32_t attemptStart = now;
+    uint16_t recvState = bus.receive();
+    now = micros();
+    if (recvState != PJON_FAIL || (uint32_t)(now - attemptStart) >= SWBB_BIT_WIDTH) {
+      lastActivity = now;
+    }
+  } while ((uint32_t)(now - start) < maxMicros && (uint32_t)(now - lastActivity) < commQuietMicros);
+  return (uint32_t)(now - start);
+}
+
+
+
+
+/**
+ * Number of packets PJON is still sending to nodeId.
+ */
+uint8_t packetsInFlightTo(uint8_t nodeId) {
+  uint8_t inFlight = 0;
+  for (uint8_t i=0; i<sizeof(bus.packets) / sizeof(bus.packets[0]); i++) {
+    if (bus.packets[i].state != 0 && bus.packets[i].content[0] == nodeId) {
+      inFlight++;
+    }
+  }
+  return inFlight;
+}
+
+bool busHasFreePacket() {
+  for (uint8_t i=0; i<sizeof(bus.packets) / sizeof(bus.packets[0]); i++) {
+    if (bus.packets[i].state == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Priority class of an event that was sent without one.
+ */
+uint8_t eventPriority(int eventId) {
+  switch (eventId) {
+    case CE_START_PUZZLE:
+    case CE_START_SUB_PUZZLE:
+    case CE_PUZZLE_START_SUCCESS:
+    case CE_RESET_NODE:
+    case CE_NODE_RESET_SUCCESS:
+    case CE_RESET_AND_START_PUZZLE:
+    case CE_RESET_AND_START_SUCCESS:
+      return GAME_PRIORITY_CONTROL;
+    case CE_PLAY_TRACK:
+    case CE_PLAY_TRACK_SUCCESS:
+      return GAME_PRIORITY_AUDIO;
+    case CE_PING:
+    case CE_PONG:
+    case CE_ACK:
+    case CE_REQUEST_STATS:
+    case CE_STATS:
+    case CE_REQUEST_STATE_SYNC:
+    case CE_STATE_DELTA:
+      return GAME_PRIORITY_TELEMETRY;
+  }
+  return GAME_PRIORITY_GAME;
+}
+
+/**
+ * Take a frame out of its queue and free its slot. prev is the frame before it in the queue.
+ */
+void unlinkOutboundFrame(outboundQueueStruct *queue, uint8_t slot, uint8_t prev) {
+  if (prev == NO_OUTBOUND_SLOT) {
+    queue->head = outboundFrames[slot].next;
+  } else {
+    outboundFrames[prev].next = outboundFrames[slot].next;
+  }
+  if (queue->tail == slot) {
+    queue->tail = prev;
+  }
+  if (queue->head == NO_OUTBOUND_SLOT) {
+    queue->nodeId = 0;
+    queue->tail = NO_OUTBOUND_SLOT;
+  }
+  outboundFrames[slot].length = 0;
+  outboundFrames[slot].next = NO_OUTBOUND_SLOT;
+}
+
+/**
+ * Drop the newest of the queued frames in the lowest class below priority. Returns false if there
+ * is none.
+ */
+bool dropOutboundFrameBelow(uint8_t priority) {
+  outboundQueueStruct *victimQueue = NULL;
+  uint8_t victim = NO_OUTBOUND_SLOT;
+  uint8_t victimPrev = NO_OUTBOUND_SLOT;
+  for (uint8_t q=0; q<MAX_OUTBOUND_DESTINATIONS; q++) {
+    uint8_t prev = NO_OUTBOUND_SLOT;
+    for (uint8_t slot = outboundQueues[q].head; slot != NO_OUTBOUND_SLOT; slot = outboundFrames[slot].next) {
+      if (outboundFrames[slot].priority > priority &&
+          (victim == NO_OUTBOUND_SLOT || outboundFrames[slot].priority >= outboundFrames[victim].priority)) {
+        victimQueue = &outboundQueues[q];
+        victim = slot;
+        victimPrev = prev;
+      }
+      prev = slot;
+    }
+  }
+  if (victim == NO_OUTBOUND_SLOT) {
+    return false;
+  }
+
+  commStatsStruct *stats = findCommStats(victimQueue->nodeId);
+  if (stats != NULL) {
+    countStat(stats->bufferFull);
+  }
+  unlinkOutboundFrame(victimQueue, victim, victimPrev);
+  return true;
+}
+
+/**
+ * Drop the queued frames that expired before PJON had room for them.
+ */
+void dropExpiredOutboundFrames() {
+  unsigned long now = millis();
+  for (uint8_t q=0; q<MAX_OUTBOUND_DESTINATIONS; q++) {
+    outboundQueueStruct *queue = &outboundQueues[q];
+    uint8_t prev = NO_OUTBOUND_SLOT;
+    uint8_t slot = queue->head;
+    while (slot != NO_OUTBOUND_SLOT) {
+      uint8_t next = outboundFrames[slot].next;
+      if (outboundFrames[slot].expires && (long)(now - outboundFrames[slot].expireTime) >= 0) {
+        commStatsStruct *stats = findCommStats(queue->nodeId);
+        if (stats != NULL) {
+          countStat(stats->expired);
+        }
+        unlinkOutboundFrame(queue, slot, prev);
+      } else {
+        prev = slot;
+      }
+      slot = next;
+    }
+  }
+}
+
+/**
+ * Add a frame to nodeId's outbound queue, after the frames of the same or a higher class. Frames of
+ * lower classes are dropped if that is the only way to make room. Returns false if there is no room.
+ */
+bool queueOutboundFrame(int nodeId, const char *frame, uint8_t frameLen, uint8_t priority,
+                        unsigned int expireMillis) {
+  if (frameLen == 0 || frameLen > GAME_MAX_BATCH_LENGTH) {
+    return false;
+  }
+  outboundQueueStruct *queue = NULL;
+  uint8_t slot = OUTBOUND_QUEUE_SLOTS;
+  while (true) {
+    queue = NULL;
+    for (uint8_t q=0; q<MAX_OUTBOUND_DESTINATIONS; q++) {
+      if (outboundQueues[q].nodeId == nodeId) {
+        queue = &outboundQueues[q];
+        break;
+      }
+      if (queue == NULL && outboundQueues[q].nodeId == 0) {
+        queue = &outboundQueues[q];
+      }
+    }
+    slot = 0;
+    while (slot < OUTBOUND_QUEUE_SLOTS && outboundFrames[slot].length != 0) {
+      slot++;
+    }
+    if (queue != NULL && slot < OUTBOUND_QUEUE_SLOTS) {
+      break;
+    }
+    if (!dropOutboundFrameBelow(priority)) {
+      return false;
+    }
+  }
+
+  memcpy(outboundFrames[slot].frame, frame, frameLen);
+  outboundFrames[slot].length = frameLen;
+  outboundFrames[slot].priority = priority;
+  outboundFrames[slot].expires = (expireMillis != GAME_NEVER_EXPIRE);
+  outboundFrames[slot].expireTime = millis() + expireMillis;
+  if (queue->nodeId == 0) {
+    queue->nodeId = nodeId;
+    queue->head = slot;
+    queue->tail = slot;
+    outboundFrames[slot].next = NO_OUTBOUND_SLOT;
+    return true;
+  }
+
+  uint8_t *link = &queue->head;
+  while (*link != NO_OUTBOUND_SLOT && outboundFrames[*link].priority <= priority) {
+    link = &outboundFrames[*link].next;
+  }
+  outboundFrames[slot].next = *link;
+  if (*link == NO_OUTBOUND_SLOT) {
+    queue->tail = slot;
+  }
+  *link = slot;
+  return true;
+}
+
+/**
+ * Make room in PJON's packet buffer for a frame of class priority by removing a packet of the lowest
+ * class below it. Returns false if every packet is of the same or a higher class.
+ */
+bool dropBusPacketBelow(uint8_t priority) {
+  uint8_t victim = 0xFF;
+  for (uint8_t i=0; i<sizeof(bus.packets) / sizeof(bus.packets[0]); i++) {
+    if (bus.packets[i].state != 0 && busPacketPriority[i] > priority &&
+        (victim == 0xFF || busPacketPriority[i] > busPacketPriority[victim])) {
+      victim = i;
+    }
+  }
+  if (victim == 0xFF) {
+    return false;
+  }
+  commStatsStruct *stats = findCommStats(bus.packets[victim].content[0]);
+  if (stats != NULL) {
+    countStat(stats->bufferFull);
+  }
+  bus.remove(victim);
+  return true;
+}
+
+/**
+ * Hand a frame to PJON, which copies it into its packet buffer, and note the frame's class and
+ * expiry against the packet. Returns false if PJON did not take it.
+ */
+bool sendFrameOnBus(int nodeId, const char *frame, uint8_t frameLen, uint8_t priority, bool expires,
+                    uint32_t expireTime) {
+  uint16_t packet = bus.send(nodeId, frame, frameLen);
+  if (packet == PJON_FAIL) {
+    return false;
+  }
+  busPacketPriority[packet] = priority;
+  busPacketExpires[packet] = expires;
+  busPacketExpireTime[packet] = expireTime;
+  if (expires) {
+    noteBusPacketExpiry(expireTime);
+  }
+  commStatsStruct *stats = findCommStats(nodeId);
+  if (stats != NULL) {
+    countStat(stats->framesSent);
+  }
+  return true;
+}
+
+bool outboundQueuesEmpty() {
+  for (uint8_t q=0; q<MAX_OUTBOUND_DESTINATIONS; q++) {
+    if (outboundQueues[q].nodeId != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Hand queued frames to PJON while it has room. The queue whose next frame is in the highest class
+ * goes first, queues with frames in the same class take turns. A node that already has
+ * OUTBOUND_MAX_IN_FLIGHT packets in PJON waits, except for control frames. If PJON is full a packet
+ * of a lower class is dropped for the frame.
+ */
+void admitOutboundFrames() {
+  dropExpiredOutboundFrames();
+  while (true) {
+    outboundQueueStruct *queue = NULL;
+    uint8_t chosen = 0;
+    for (uint8_t k=0; k<MAX_OUTBOUND_DESTINATIONS; k++) {
+      uint8_t q = (nextOutboundQueue + k) % MAX_OUTBOUND_DESTINATIONS;
+      outboundQueueStruct *candidate = &outboundQueues[q];
+      if (candidate->nodeId == 0) {
+        continue;
+      }
+      uint8_t priority = outboundFrames[candidate->head].priority;
+      if (priority != GAME_PRIORITY_CONTROL && packetsInFlightTo(candidate->nodeId) >= OUTBOUND_MAX_IN_FLIGHT) {
+        continue;
+      }
+      if (queue == NULL || priority < outboundFrames[queue->head].priority) {
+        queue = candidate;
+        chosen = q;
+      }
+    }
+    if (queue == NULL) {
+      return;
+    }
+
+    outboundFrameStruct *out = &outboundFrames[queue->head];
+    if (!busHasFreePacket() && !dropBusPacketBelow(out->priority)) {
+      return;
+    }
+    if (!sendFrameOnBus(queue->nodeId, out->frame, out->length, out->priority, out->expires, out->expireTime)) {
+      return;
+    }
+    unlinkOutboundFrame(queue, queue->head, NO_OUTBOUND_SLOT);
+    nextOutboundQueue = (chosen + 1) % MAX_OUTBOUND_DESTINATIONS;
+  }
+}
+
+/**
+ * Queue a frame for nodeId and pass it to PJON as soon as the node's turn comes up. When nothing is
+ * queued and PJON has room the frame would be admitted right away, so it goes straight to PJON
+ * without the copy into the outbound queue.
+ */
+void transmitFrameToNode(int nodeId, const char *frame, uint8_t frameLen, uint8_t priority,
+                         unsigned int expireMillis) {
+#ifdef DO_COMM_UTILS_DEBUG
+  Serial.print(F("++SEND NodeId: "));
+  Serial.print(nodeId);
+  Serial.print(F(" ["));
+  for (byte ii=0; ii<frameLen; ii++) {
+    Serial.print(' ');
+    Serial.print((uint8_t) frame[ii], HEX);
+  }
+  Serial.println(F(" ]"));
+#endif
+
+  if (outboundQueuesEmpty() && busHasFreePacket() &&
+      (priority == GAME_PRIORITY_CONTROL || packetsInFlightTo(nodeId) < OUTBOUND_MAX_IN_FLIGHT) &&
+      sendFrameOnBus(nodeId, frame, frameLen, priority, expireMillis != GAME_NEVER_EXPIRE, millis() + expireMillis)) {
+    processSend();
+    return;
+  }
+
+  if (!queueOutboundFrame(nodeId, frame, frameLen, priority, expireMillis)) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.println(F("Outbound queue full, frame dropped"));
+#endif
+    commStatsStruct *stats = findCommStats(nodeId);
+    if (stats != NULL) {
+      countStat(stats->bufferFull);
+    }
+  }
+  admitOutboundFrames();
+  processSend();
+}
+
+/**
+ * Send the open batch, if there is one.
+ */
+void flushBatch() {
+  if (batchEventCount == 0) {
+    return;
+  }
+  batchBuffer[0] = (batchEventCount == 1) ? GAME_FRAME_V1 : GAME_FRAME_BATCH;
+  uint8_t frameLen = batchLength;
+  batchEventCount = 0;
+  batchLength = 0;
+  transmitFrameToNode(batchNode, batchBuffer, frameLen, batchPriority, batchExpireMillis);
+}
+
+/**
+ * Flush the open batch once its window has passed. Called from doComm().
+ */
+void processBatch() {
+  if (batchEventCount > 0 && (millis() - batchStartTime) >= batchWindow) {
+    flushBatch();
+  }
+}
+
+/**
+ * Send the frame composed in sendBuffer. Binary frames are added to the open batch for the node when
+ * batching is on, everything else goes to PJON right away. A control frame closes the batch it joins
+ * so it is not held for the batch window, and so does the GAME_MAX_BATCH_EVENTS'th event.
+ */
+void sendFrameToNode(int nodeId, uint8_t frameLen, uint8_t priority = GAME_PRIORITY_BY_EVENT,
+                     unsigned int expireMillis = GAME_EXPIRE_BY_PRIORITY) {
+  cacheSequencedReply(nodeId, frameLen);
+
+  if (priority == GAME_PRIORITY_BY_EVENT) {
+    if ((uint8_t)sendBuffer[0] == GAME_FRAME_V1) {
+      priority = eventPriority((uint8_t)sendBuffer[1]);
+    } else {
+      priority = eventPriority((sendBuffer[1] - '0') * 10 + (sendBuffer[2] - '0'));
+    }
+  }
+  if (expireMillis == GAME_EXPIRE_BY_PRIORITY) {
+    expireMillis = priorityExpireMillis[priority];
+  }
+
+  if (batchWindow == 0 || (uint8_t)sendBuffer[0] != GAME_FRAME_V1 || frameLen > GAME_MAX_BATCH_LENGTH) {
+    flushBatch();   // Keep the events in order
+    transmitFrameToNode(nodeId, sendBuffer, frameLen, priority, expireMillis);
+    return;
+  }
+
+  // The record is the frame without its marker byte.
+  uint8_t recordLen = frameLen - 1;
+  if (batchEventCount > 0 && (batchNode != nodeId || batchLength + recordLen > GAME_MAX_BATCH_LENGTH ||
+                              batchEventCount == GAME_MAX_BATCH_EVENTS)) {
+    flushBatch();
+  }
+  if (batchEventCount == 0) {
+    batchNode = nodeId;
+    batchLength = 1;     // Room for the marker
+    batchStartTime = millis();
+    batchPriority = priority;
+    batchExpireMillis = expireMillis;
+  }
+  memcpy(&batchBuffer[batchLength], &sendBuffer[1], recordLen);
+  batchLength += recordLen;
+  batchEventCount++;
+  if (priority < batchPriority) {
+    batchPriority = priority;
+  }
+  // The batch lives as long as its longest lived event.
+  if (expireMillis == GAME_NEVER_EXPIRE || (batchExpireMillis != GAME_NEVER_EXPIRE && expireMillis > batchExpireMillis)) {
+    batchExpireMillis = expireMillis;
+  }
+  if (priority == GAME_PRIORITY_CONTROL || batchEventCount == GAME_MAX_BATCH_EVENTS) {
+    flushBatch();
+  }
+}
+
+/**
+ * The duplicate suppression entry for a sender. Takes a free entry, or the one quiet the longest,
+ * if the sender has none yet.
+ */
+sequenceWindowStruct *findSequenceWindow(uint8_t nodeId) {
+  unsigned long now = millis();
+  sequenceWindowStruct *unused = NULL;
+  sequenceWindowStruct *oldest = NULL;
+  for (uint8_t i=0; i<MAX_SEQUENCE_SENDERS; i++) {
+    sequenceWindowStruct *entry = &sequenceWindows[i];
+    if (entry->nodeId == nodeId) {
+      return entry;
+    }
+    if (entry->nodeId == 0) {
+      if (unused == NULL) {
+        unused = entry;
+      }
+    } else if (oldest == NULL || (now - entry->lastSeen) > (now - oldest->lastSeen)) {
+      // Ages, not times, are compared so the choice holds across the millis() wrap
+      oldest = entry;
+    }
+  }
+  if (unused != NULL) {
+    return unused;
+  }
+  // A window its sender may still resend into is not taken, that request could be handled twice
+  if ((now - oldest->lastSeen) < GAME_SEQUENCE_EXPIRE_MILLIS) {
+    return NULL;
+  }
+  oldest->nodeId = 0;
+  return oldest;
+}
+
+/**
+ * Check the sequence number of the request in eventData. Returns true if it is new and should be
+ * handled. A resend of a request that was already handled is answered with the cached reply, if the
+ * reply has been sent yet, and returns false.
+ */
+bool acceptSequencedEvent() {
+  sequenceWindowStruct *entry = findSequenceWindow(eventData.sentFrom);
+  if (entry == NULL) {
+    // Not handled and not answered. The sender resends, and its request fails if no window frees up.
+    countStat(sequenceWindowsFull);
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.print(F("--RECV no sequence window for "));
+    Serial.println(eventData.sentFrom);
+#endif
+    return false;
+  }
+  uint8_t sequence = eventData.sequence;
+  unsigned long now = millis();
+
+  if (entry->nodeId == 0 || entry->bootEpoch != eventData.bootEpoch ||
+      (now - entry->lastSeen) >= GAME_SEQUENCE_EXPIRE_MILLIS) {
+    // New sender, or one that has restarted or been quiet for long. Its numbering starts over.
+    entry->nodeId = eventData.sentFrom;
+    entry->bootEpoch = eventData.bootEpoch;
+    entry->highestSequence = sequence;
+    entry->window = 1;
+  } else {
+    int8_t ahead = (int8_t)(sequence - entry->highestSequence);
+    if (ahead > 0) {
+      entry->window = (ahead >= SEQUENCE_WINDOW_SIZE) ? 1 : (entry->window << ahead) | 1;
+      entry->highestSequence = sequence;
+    } else if (-ahead >= SEQUENCE_WINDOW_SIZE) {
+      // Far behind the window, the sender has restarted its numbering.
+      entry->highestSequence = sequence;
+      entry->window = 1;
+    } else if (entry->window & (1 << -ahead)) {
+      entry->lastSeen = now;
+      countStat(duplicatesSuppressed);
+      if (sequence == entry->replySequence && eventData.correlationId == entry->replyCorrelation &&
+          entry->replyLength > 0) {
+        memcpy(sendBuffer, entry->reply, entry->replyLength);
+        sendFrameToNode(entry->nodeId, entry->replyLength);
+      }
+#ifdef DO_COMM_UTILS_DEBUG
+      Serial.print(F("--RECV duplicate request from "));
+      Serial.println(entry->nodeId);
+#endif
+      return false;
+    } else {
+      entry->window |= (1 << -ahead);
+    }
+  }
+
+  entry->lastSeen = now;
+  entry->replySequence = sequence;
+  entry->replyCorrelation = eventData.correlationId;
+  entry->replyLength = 0;
+  return true;
+}
+
+/**
+ * Keep a copy of a reply to a sequenced request, from sendBuffer, so a resend of the request can be
+ * answered without handling it again. The reply may be sent any time after the request arrived.
+ */
+void cacheSequencedReply(int nodeId, uint8_t frameLen) {
+  if ((uint8_t)sendBuffer[0] != GAME_FRAME_V1 || !(sendBuffer[2] & GAME_FRAME_FLAG_CORRELATION) ||
+      frameLen > GAME_MAX_FRAME_LENGTH) {
+    return;
+  }
+  for (uint8_t i=0; i<MAX_SEQUENCE_SENDERS; i++) {
+    sequenceWindowStruct *entry = &sequenceWindows[i];
+    if (entry->nodeId == nodeId && entry->replyCorrelation == (uint8_t)sendBuffer[4]) {
+      memcpy(entry->reply, sendBuffer, frameLen);
+      entry->replyLength = frameLen;
+      return;
+    }
+  }
+}
+
+#ifdef GAME_COMM_SEND_LEGACY_FRAMES
+/**
+ * Compose an old style padded ASCII frame in sendBuffer and send it.
+ */
+bool sendLegacyFrameToNode(int nodeId, int eventId, const char *gameData, uint8_t dataLen,
+                           uint8_t priority = GAME_PRIORITY_BY_EVENT,
+                           unsigned int expireMillis = GAME_EXPIRE_BY_PRIORITY) {
+  // First character is the Game Comm Packet Start Character
+  // Character 2 and 3 are event ID. To make it easy only support event ID values
+  // of 10 - 99.
+  // Characters 4-20 are data.
+  if (eventId < 10 || eventId > 99 || dataLen > (MAX_EVENT_DATA-3)) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.println(F("Bad request in commUtils"));
+#endif
+    return false;
+  }
+  // Nodes that still take legacy frames know the completion reply by its old id only
+  if (eventId == CE_PUZZLE_COMPLETED_SUCCESS) {
+    eventId = CE_OLD_PUZZLE_COMPLETED_SUCCESS;
+  }
+
+  sendBuffer[0] = GAME_START_PACKET_CHAR;
+  sendBuffer[1] = '0' + (eventId / 10);
+  sendBuffer[2] = '0' + (eventId % 10);
+  memcpy(&sendBuffer[3], gameData, dataLen);
+  memcpy(&sendBuffer[dataLen + 3], padBuffer, MAX_EVENT_DATA - dataLen - 3);
+
+  // Always send a full packet - then we know we have always received a full packet.
+  sendFrameToNode(nodeId, MAX_EVENT_DATA, priority, expireMillis);
+  return true;
+}
+#endif
+
+/**
+ * Write the frame header and optional fields into sendBuffer. Returns the offset the payload goes at,
+ * or 0 if the event can not be encoded. A correlationId of 0 sends no correlation id.
+ */
+uint8_t composeFrameHeader(int eventId, uint8_t dataType, uint8_t dataLen, uint8_t correlationId, uint8_t sequence = 0) {
+  if (eventId < 10 || eventId > 99 || dataLen > MAX_EVENT_DATA) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.println(F("Bad request in commUtils"));
+#endif
+    return 0;
+  }
+
+  uint8_t frameLen = GAME_FRAME_HEADER_LENGTH;
+  sendBuffer[0] = GAME_FRAME_V1;
+  sendBuffer[1] = eventId;
+  sendBuffer[2] = dataType;
+  sendBuffer[3] = dataLen;
+  if (correlationId != 0) {
+    sendBuffer[2] |= GAME_FRAME_FLAG_CORRELATION;
+    sendBuffer[frameLen++] = correlationId;
+  }
+  if (sequence != 0) {
+    sendBuffer[2] |= GAME_FRAME_FLAG_SEQUENCE;
+    sendBuffer[frameLen++] = bootEpoch;
+    sendBuffer[frameLen++] = sequence;
+  }
+  return frameLen;
+}
+
+/**
+ * Compose a frame in sendBuffer and send it. Returns false if the event can not be encoded.
+ * A correlationId of 0 sends no correlation id. This is the one send path, the payload is copied
+ * straight into sendBuffer and nothing is allocated. See GamePriority for priority and
+ * GAME_AUDIO_EXPIRE_MILLIS for expireMillis.
+ */
+bool sendPayloadToNode(int nodeId, int eventId, uint8_t dataType, const uint8_t *data, uint8_t dataLen,
+                       uint8_t correlationId = 0, uint8_t sequence = 0,
+                       uint8_t priority = GAME_PRIORITY_BY_EVENT,
+                       unsigned int expireMillis = GAME_EXPIRE_BY_PRIORITY) {
+#ifdef GAME_COMM_SEND_LEGACY_FRAMES
+  // Legacy frames have no room for a correlation id, responses are matched on the event id only.
+  if (dataType == GAME_PAYLOAD_INT) {
+    itoa((int16_t)(data[0] | (data[1] << 8)), &intDataBuffer[0], 10);
+    return sendLegacyFrameToNode(nodeId, eventId, intDataBuffer, strlen(intDataBuffer), priority, expireMillis);
+  }
+  return sendLegacyFrameToNode(nodeId, eventId, (const char *)data, dataLen, priority, expireMillis);
+#else
+  uint8_t frameLen = composeFrameHeader(eventId, dataType, dataLen, correlationId, sequence);
+  if (frameLen == 0) {
+    return false;
+  }
+  if (dataLen > 0) {
+    memcpy(&sendBuffer[frameLen], data, dataLen);
+  }
+
+  sendFrameToNode(nodeId, frameLen + dataLen, priority, expireMillis);
+  return true;
+#endif
+}
+
+/**
+ * Same as sendPayloadToNode() for a string kept in flash with F() or PROGMEM.
+ */
+bool sendFlashPayloadToNode(int nodeId, int eventId, const __FlashStringHelper *gameData, uint8_t correlationId = 0) {
+  PGM_P flashData = reinterpret_cast<PGM_P>(gameData);
+  size_t dataLen = strlen_P(flashData);
+  if (dataLen > MAX_EVENT_DATA) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.println(F("Bad request in commUtils"));
+#endif
+    return false;
+  }
+#ifdef GAME_COMM_SEND_LEGACY_FRAMES
+  char ramData[MAX_EVENT_DATA];
+  memcpy_P(ramData, flashData, dataLen);
+  return sendLegacyFrameToNode(nodeId, eventId, ramData, dataLen);
+#else
+  uint8_t frameLen = composeFrameHeader(eventId, dataLen > 0 ? GAME_PAYLOAD_STRING : GAME_PAYLOAD_NONE,
+                                        dataLen, correlationId);
+  if (frameLen == 0) {
+    return false;
+  }
+  memcpy_P(&sendBuffer[frameLen], flashData, dataLen);
+
+  sendFrameToNode(nodeId, frameLen + dataLen);
+  return true;
+#endif
+}
+
+/**
+ * Send a string payload, or no payload for an empty or NULL string.
+ */
+bool sendTextPayloadToNode(int nodeId, int eventId, const char *gameData, uint8_t correlationId = 0,
+                           uint8_t priority = GAME_PRIORITY_BY_EVENT,
+                           unsigned int expireMillis = GAME_EXPIRE_BY_PRIORITY) {
+  size_t dataLen = (gameData == NULL) ? 0 : strlen(gameData);
+  if (dataLen > MAX_EVENT_DATA) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.println(F("Bad request in commUtils"));
+#endif
+    return false;
+  }
+  return sendPayloadToNode(nodeId, eventId, dataLen > 0 ? GAME_PAYLOAD_STRING : GAME_PAYLOAD_NONE,
+                           (const uint8_t *)gameData, dataLen, correlationId, 0, priority, expireMillis);
+}
+
+/**
+ * Send an Event to the specified Node.
+ */
+void sendEventToNode(int nodeId, int eventId, const char *gameData) {
+  sendTextPayloadToNode(nodeId, eventId, gameData);
+}
+
+void sendEventToNode(int nodeId, int eventId, const __FlashStringHelper *gameData) {
+  sendFlashPayloadToNode(nodeId, eventId, gameData);
+}
+
+/**
+ * Kept for old callers. Prefer the const char* and F() versions, a String uses the heap.
+ */
+void sendEventToNode(int nodeId, int eventId, const String &gameData) {
+  sendTextPayloadToNode(nodeId, eventId, gameData.c_str());
+}
+
+/**
+ * Send an Event without data.
+ */
+void sendEventToNode(int nodeId, int eventId) {
+  sendPayloadToNode(nodeId, eventId, GAME_PAYLOAD_NONE, NULL, 0);
+}
+
+/**
+ * Send an Event in a priority class of the caller's choosing instead of the event's usual one.
+ */
+void sendEventToNode(int nodeId, int eventId, const char *gameData, GamePriority priority) {
+  sendTextPayloadToNode(nodeId, eventId, gameData, 0, priority);
+}
+
+void sendEventToNode(int nodeId, int eventId, GamePriority priority) {
+  sendPayloadToNode(nodeId, eventId, GAME_PAYLOAD_NONE, NULL, 0, 0, 0, priority);
+}
+
+/**
+ * Send an Event that is dropped if it has not been delivered within expireMillis. GAME_NEVER_EXPIRE
+ * keeps trying for as long as PJON does.
+ */
+void sendEventToNode(int nodeId, int eventId, const char *gameData, GamePriority priority,
+                     unsigned int expireMillis) {
+  sendTextPayloadToNode(nodeId, eventId, gameData, 0, priority, expireMillis);
+}
+
+/**
+ * Send an event back to the node the current eventData came from. The correlation id of the
+ * received event is echoed so the sender can match the response to its request.
+ */
+void replyToSender(int eventId, const char *gameData) {
+  sendTextPayloadToNode(eventData.sentFrom, eventId, gameData, eventData.correlationId);
+}
+
+void replyToSender(int eventId, const __FlashStringHelper *gameData) {
+  sendFlashPayloadToNode(eventData.sentFrom, eventId, gameData, eventData.correlationId);
+}
+
+void replyToSender(int eventId, const String &gameData) {
+  sendTextPayloadToNode(eventData.sentFrom, eventId, gameData.c_str(), eventData.correlationId);
+}
+
+
+/**
+ * Send an event to the game controller
+ */
+void sendEventToController(int eventId, const char *gameData) {
+  sendEventToNode(GAME_CONTROLLER_NODE,eventId, gameData);
+}
+
+void sendEventToController(int eventId, const __FlashStringHelper *gameData) {
+  sendEventToNode(GAME_CONTROLLER_NODE,eventId, gameData);
+}
+
+void sendEventToController(int eventId, const String &gameData) {
+  sendEventToNode(GAME_CONTROLLER_NODE,eventId, gameData);
+}
+
+/**
+ * Send an Event where the data is an integer.
+ */
+void sendIntEventToNode(int nodeId, int eventId, int intGameData) {
+  uint8_t intBytes[2] = { (uint8_t)(intGameData & 0xFF), (uint8_t)((intGameData >> 8) & 0xFF) };
+  sendPayloadToNode(nodeId, eventId, GAME_PAYLOAD_INT, intBytes, 2);
+}
+
+/**
+ * Send an Event where the data is raw bytes.
+ */
+void sendBytesEventToNode(int nodeId, int eventId, const uint8_t *gameData, uint8_t dataLen) {
+  sendPayloadToNode(nodeId, eventId, dataLen > 0 ? GAME_PAYLOAD_BYTES : GAME_PAYLOAD_NONE, gameData, dataLen);
+}
+
+void sendPuzzleCompleteEvent(int fromNode) {
+  sendIntEventToNode(GAME_CONTROLLER_NODE, CE_PUZZLE_COMPLETED, fromNode);
+}
+
+/**
+ * Queue an int event from an interrupt handler. doComm() sends it like sendIntEventToNode(). Returns
+ * false, and counts the event as dropped, if the queue is full. Only call this from an ISR, the main
+ * loop sends with sendEventToNode().
+ */
+bool queueEventFromISR(uint8_t nodeId, uint8_t eventId, int value) {
+  uint8_t head = isrEventHead;
+  if ((uint8_t)(head - isrEventTail) >= ISR_EVENT_QUEUE_SLOTS) {
+    isrEventsDropped++;
+    return false;
+  }
+  volatile isrEventStruct &slot = isrEvents[head & ISR_EVENT_QUEUE_MASK];
+  slot.nodeId = nodeId;
+  slot.eventId = eventId;
+  slot.value = value;
+  // The slot is filled before the head moves past it, so doComm() never sees a half written event
+  isrEventHead = head + 1;
+  return true;
+}
+
+/**
+ * Set the newest value of an int event from an interrupt handler. doComm() sends it once, with the
+ * value set last, however often it was set since the last doComm(). Returns false, and counts the
+ * value as dropped, if every slot holds another event. Only call this from an ISR.
+ */
+bool setLatestFromISR(uint8_t nodeId, uint8_t eventId, int value) {
+  volatile isrLatestStruct *slot = NULL;
+  for (uint8_t i = 0; i < ISR_LATEST_SLOTS; i++) {
+    if (isrLatest[i].eventId == eventId && isrLatest[i].nodeId == nodeId) {
+      slot = &isrLatest[i];
+      break;
+    }
+    if (isrLatest[i].eventId == 0 && slot == NULL) {
+      slot = &isrLatest[i];
+    }
+  }
+  if (slot == NULL) {
+    isrEventsDropped++;
+    return false;
+  }
+  slot->nodeId = nodeId;
+  slot->eventId = eventId;
+  slot->value = value;
+  // The value is written before the version moves, so doComm() never keeps a half written value
+  slot->version++;
+  return true;
+}
+
+/**
+ * Send the latest values set by interrupt handlers that changed since they were last sent.
+ */
+void processIsrLatest() {
+  for (uint8_t i = 0; i < ISR_LATEST_SLOTS; i++) {
+    volatile isrLatestStruct &slot = isrLatest[i];
+    uint8_t version = slot.version;
+    if (slot.eventId == 0 || version == slot.sentVersion) {
+      continue;
+    }
+    int value = slot.value;
+    while (slot.version != version) {
+      version = slot.version;
+      value = slot.value;
+    }
+    slot.sentVersion = version;
+    uint8_t intBytes[2] = { (uint8_t)(value & 0xFF), (uint8_t)((value >> 8) & 0xFF) };
+    sendPayloadToNode(slot.nodeId, slot.eventId, GAME_PAYLOAD_INT, intBytes, 2, 0, 0,
+                      GAME_PRIORITY_BY_EVENT, GAME_LATEST_EXPIRE_MILLIS);
+  }
+}
+
+/**
+ * Send the events queued and the latest values set by interrupt handlers. Called from doComm().
+ */
+void processIsrEvents() {
+  uint8_t tail = isrEventTail;
+  while (tail != isrEventHead) {
+    volatile isrEventStruct &slot = isrEvents[tail & ISR_EVENT_QUEUE_MASK];
+    uint8_t nodeId = slot.nodeId;
+    uint8_t eventId = slot.eventId;
+    int value = slot.value;
+    // Hand the slot back to the ISR before sending, sending can take a while
+    isrEventTail = ++tail;
+    sendIntEventToNode(nodeId, eventId, value);
+  }
+  processIsrLatest();
+
+  uint8_t dropped = isrEventsDropped;
+  if (dropped != isrEventsDroppedReported) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.print(F("ISR events dropped: "));
+    Serial.println((uint8_t)(dropped - isrEventsDroppedReported));
+#endif
+    isrEventsDroppedReported = dropped;
+  }
+}
+
+
+/**
+ * Start a request. The event is sent now and resent from doComm() every responseWaitTime until
+ * responseEvent comes back from nodeId, or REQUEST_MAX_ATTEMPTS sends have been made.
+ * Returns the handle passed to the callback, or NO_GAME_REQUEST if all request slots are in use.
+ */
+GameRequestHandle sendPayloadRequestToNode(int nodeId, int eventId, int responseEvent, uint8_t dataType,
+                                           const uint8_t *data, uint8_t dataLen, GameRequestCallback callback) {
+  if (dataLen > MAX_EVENT_DATA) {
+    return NO_GAME_REQUEST;
+  }
+
+  pendingRequestStruct *request = NULL;
+  for (uint8_t i=0; i<MAX_PENDING_REQUESTS; i++) {
+    if (pendingRequests[i].handle == NO_GAME_REQUEST) {
+      request = &pendingRequests[i];
+      break;
+    }
+  }
+  if (request == NULL) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.println(F("No free request slot"));
+#endif
+    return NO_GAME_REQUEST;
+  }
+
+  // Next handle that is not 0 and not already in use.
+  bool inUse = true;
+  while (inUse) {
+    lastRequestHandle++;
+    inUse = (lastRequestHandle == NO_GAME_REQUEST);
+    for (uint8_t i=0; i<MAX_PENDING_REQUESTS && !inUse; i++) {
+      inUse = (pendingRequests[i].handle == lastRequestHandle);
+    }
+  }
+
+  request->handle = lastRequestHandle;
+  request->nodeId = nodeId;
+  request->event = eventId;
+  request->responseEvent = responseEvent;
+  request->attempts = 1;
+  do {
+    lastSequence++;
+  } while (lastSequence == 0);
+  request->sequence = lastSequence;
+  request->dataType = dataType;
+  request->dataLength = dataLen;
+  if (dataLen > 0) {
+    memcpy(request->data, data, dataLen);
+  }
+  request->callback = callback;
+  request->sentTime = millis();
+
+  if (!sendPayloadToNode(nodeId, eventId, dataType, data, dataLen, request->handle, request->sequence)) {
+    request->handle = NO_GAME_REQUEST;
+    return NO_GAME_REQUEST;
+  }
+  return request->handle;
+}
+
+GameRequestHandle sendRequestToNode(int nodeId, int eventId, int responseEvent, const char *gameData,
+                                    GameRequestCallback callback) {
+  size_t dataLen = (gameData == NULL) ? 0 : strlen(gameData);
+  if (dataLen > MAX_EVENT_DATA) {
+    return NO_GAME_REQUEST;
+  }
+  return sendPayloadRequestToNode(nodeId, eventId, responseEvent,
+                                  dataLen > 0 ? GAME_PAYLOAD_STRING : GAME_PAYLOAD_NONE,
+                                  (const uint8_t *)gameData, dataLen, callback);
+}
+
+GameRequestHandle sendRequestToNode(int nodeId, int eventId, int responseEvent, const String &gameData,
+                                    GameRequestCallback callback) {
+  return sendRequestToNode(nodeId, eventId, responseEvent, gameData.c_str(), callback);
+}
+
+GameRequestHandle sendIntRequestToNode(int nodeId, int eventId, int responseEvent, int intGameData,
+                                       GameRequestCallback callback) {
+  uint8_t intBytes[2] = { (uint8_t)(intGameData & 0xFF), (uint8_t)((intGameData >> 8) & 0xFF) };
+  return sendPayloadRequestToNode(nodeId, eventId, responseEvent, GAME_PAYLOAD_INT, intBytes, 2, callback);
+}
+
+/**
+ * Send a schema event that has no payload.
+ */
+template <typename Event>
+bool sendGameEvent(int nodeId) {
+  static_assert(Event::Traits::type == GAME_PAYLOAD_NONE, "This event has a payload");
+  return sendPayloadToNode(nodeId, Event::id, GAME_PAYLOAD_NONE, NULL, 0);
+}
+
+/**
+ * Send a schema event with its payload. Returns false if the payload can not be encoded.
+ */
+template <typename Event>
+bool sendGameEvent(int nodeId, typename Event::Traits::Arg payload, uint8_t correlationId = 0) {
+  uint8_t scratch[Event::Traits::length];
+  uint8_t dataLen = 0;
+  const uint8_t *data = Event::Traits::bytes(payload, scratch, dataLen);
+  if (data == NULL) {
+    return false;
+  }
+  return sendPayloadToNode(nodeId, Event::id, dataLen > 0 ? Event::Traits::type : GAME_PAYLOAD_NONE,
+                           data, dataLen, correlationId);
+}
+
+/**
+ * Answer the event in eventData with a schema event, echoing its correlation id.
+ */
+template <typename Event>
+bool replyGameEvent() {
+  static_assert(Event::Traits::type == GAME_PAYLOAD_NONE, "This event has a payload");
+  return sendPayloadToNode(eventData.sentFrom, Event::id, GAME_PAYLOAD_NONE, NULL, 0, eventData.correlationId);
+}
+
+template <typename Event>
+bool replyGameEvent(typename Event::Traits::Arg payload) {
+  return sendGameEvent<Event>(eventData.sentFrom, payload, eventData.correlationId);
+}
+
+/**
+ * Start a request for a schema event. The response event is the reply declared in the schema.
+ */
+template <typename Event>
+GameRequestHandle sendGameRequest(int nodeId, GameRequestCallback callback) {
+  static_assert(Event::replyId != NO_REPLY_EVENT, "This event has no reply to wait for");
+  static_assert(Event::Traits::type == GAME_PAYLOAD_NONE, "This event has a payload");
+  return sendPayloadRequestToNode(nodeId, Event::id, Event::replyId, GAME_PAYLOAD_NONE, NULL, 0, callback);
+}
+
+template <typename Event>
+GameRequestHandle sendGameRequest(int nodeId, typename Event::Traits::Arg payload, GameRequestCallback callback) {
+  static_assert(Event::replyId != NO_REPLY_EVENT, "This event has no reply to wait for");
+  uint8_t scratch[Event::Traits::length];
+  uint8_t dataLen = 0;
+  const uint8_t *data = Event::Traits::bytes(payload, scratch, dataLen);
+  if (data == NULL) {
+    return NO_GAME_REQUEST;
+  }
+  return sendPayloadRequestToNode(nodeId, Event::id, Event::replyId,
+                                  dataLen > 0 ? Event::Traits::type : GAME_PAYLOAD_NONE, data, dataLen, callback);
+}
+
+/**
+ * The payload of a received schema event, read in place. NULL if event is a different event or its
+ * payload does not have the declared type and size. A text payload may also be empty.
+ */
+template <typename Event>
+const typename Event::View *gameEventPayload(const eventDataStruct &event) {
+  typedef typename Event::Traits Traits;
+  if (event.event != Event::id) {
+    return NULL;
+  }
+  bool typeMatches = (event.dataType == Traits::type) ||
+                     (Traits::type == GAME_PAYLOAD_STRING && event.dataType == GAME_PAYLOAD_NONE);
+  if (!typeMatches || (Traits::fixedLength && event.dataLength != Traits::length)) {
+    return NULL;
+  }
+  return Traits::view(event);
+}
+
+/**
+ * Ask nodeId for its comm stats entry at index. Decode the CE_STATS response with decodeCommStats()
+ * in the callback, then ask for index + 1 until it returns false.
+ */
+GameRequestHandle requestCommStats(int nodeId, int index, GameRequestCallback callback) {
+  return sendGameRequest<RequestStatsEvent>(nodeId, index, callback);
+}
+
+/**
+ * Fill stats from a received CE_STATS event. Returns false if it holds no entry. Only the average
+ * round trip is sent, it comes back as rttTotal with a rttCount of 1.
+ */
+bool decodeCommStats(const eventDataStruct &event, commStatsStruct &stats) {
+  const CommStatsPayload *payload = gameEventPayload<StatsEvent>(event);
+  if (payload == NULL) {
+    return false;
+  }
+  stats.nodeId = payload->nodeId;
+  stats.framesSent = payload->framesSent;
+  stats.attempts = payload->attempts;
+  stats.naks = payload->naks;
+  stats.connectionLost = payload->connectionLost;
+  stats.bufferFull = payload->bufferFull;
+  stats.junkReceived = payload->junkReceived;
+  stats.eventsDropped = payload->eventsDropped;
+  stats.expired = payload->expired;
+  stats.rttMin = payload->rttMin;
+  stats.rttTotal = payload->rttAvg;
+  stats.rttCount = 1;
+  stats.rttMax = payload->rttMax;
+  return true;
+}
+
+void printCommStats(int fromNode, const commStatsStruct &stats) {
+  Serial.print(F("Stats "));
+  Serial.print(fromNode);
+  Serial.print(F("->"));
+  Serial.print(stats.nodeId);
+  Serial.print(F(" sent: "));
+  Serial.print(stats.framesSent);
+  Serial.print(F(", attempts: "));
+  Serial.print(stats.attempts);
+  Serial.print(F(", NAK: "));
+  Serial.print(stats.naks);
+  Serial.print(F(", lost: "));
+  Serial.print(stats.connectionLost);
+  Serial.print(F(", full: "));
+  Serial.print(stats.bufferFull);
+  Serial.print(F(", junk: "));
+  Serial.print(stats.junkReceived);
+  Serial.print(F(", dropped: "));
+  Serial.print(stats.eventsDropped);
+  Serial.print(F(", expired: "));
+  Serial.print(stats.expired);
+  Serial.print(F(", rtt ms: "));
+  Serial.print(stats.rttMin);
+  Serial.print('/');
+  Serial.print(stats.rttCount == 0 ? 0 : stats.rttTotal / stats.rttCount);
+  Serial.print('/');
+  Serial.println(stats.rttMax);
+}
+
+/**
+ * Set one field of this puzzle's state record. Only a change is sent to the controller.
+ */
+void setStateField(uint8_t field, uint16_t value) {
+  if (field >= MAX_STATE_FIELDS) {
+    return;
+  }
+  uint8_t bit = 1 << field;
+  if ((stateFieldsUsed & bit) && stateFields[field] == value) {
+    return;
+  }
+  stateFields[field] = value;
+  stateFieldsUsed |= bit;
+  stateDirtyMask |= bit;
+}
+
+/**
+ * Send the changed state fields, or all of them after a sync request, once stateDeltaInterval has
+ * passed since the last delta. Called from doComm().
+ */
+void processStateDelta() {
+  if (stateFieldsUsed == 0 || (stateDirtyMask == 0 && !stateFullPending) ||
+      (millis() - lastStateDeltaTime) < stateDeltaInterval) {
+    return;
+  }
+  uint8_t payload[STATE_DELTA_HEADER_LENGTH + MAX_STATE_FIELDS * 2];
+  uint8_t mask = stateFullPending ? stateFieldsUsed : stateDirtyMask;
+  uint8_t length = STATE_DELTA_HEADER_LENGTH;
+  payload[0] = ++stateVersion;
+  payload[1] = stateFullPending ? STATE_DELTA_FULL : 0;
+  payload[2] = mask;
+  for (uint8_t field=0; field<MAX_STATE_FIELDS; field++) {
+    if (mask & (1 << field)) {
+      payload[length++] = stateFields[field] & 0xFF;
+      payload[length++] = stateFields[field] >> 8;
+    }
+  }
+  sendPayloadToNode(GAME_CONTROLLER_NODE, CE_STATE_DELTA, GAME_PAYLOAD_BYTES, payload, length);
+  stateDirtyMask = 0;
+  stateFullPending = false;
+  lastStateDeltaTime = millis();
+}
+
+/**
+ * Forget the state record, for a puzzle reset. The next field set starts a new full record.
+ */
+void clearStateFields() {
+  stateFieldsUsed = 0;
+  stateDirtyMask = 0;
+  stateFullPending = true;
+}
+
+void setStateDeltaInterval(unsigned int value) {
+  stateDeltaInterval = value;
+}
+
+/**
+ * Ask a puzzle for its whole state record. Repeated asks within STATE_SYNC_RETRY_MILLIS are not sent.
+ */
+void requestStateSync(puzzleStateMirrorStruct &mirror) {
+  if (mirror.syncRequestTime != 0 && (millis() - mirror.syncRequestTime) < STATE_SYNC_RETRY_MILLIS) {
+    return;
+  }
+  mirror.synced = false;
+  mirror.syncRequestTime = millis();
+  if (mirror.syncRequestTime == 0) {
+    mirror.syncRequestTime = 1;
+  }
+  sendGameEvent<RequestStateSyncEvent>(mirror.nodeId);
+}
+
+/**
+ * Apply a received CE_STATE_DELTA to the sender's mirror. A delta that does not follow the last one
+ * applied leaves the mirror as it is and asks the puzzle for a full record. Returns true if the mirror
+ * changed.
+ */
+bool applyStateDelta(const eventDataStruct &event, puzzleStateMirrorStruct &mirror) {
+  const uint8_t *payload = gameEventPayload<StateDeltaEvent>(event);
+  if (payload == NULL || event.dataLength < STATE_DELTA_HEADER_LENGTH) {
+    return false;
+  }
+  uint8_t version = payload[0];
+  bool full = payload[1] & STATE_DELTA_FULL;
+  uint8_t mask = payload[2];
+  uint8_t length = STATE_DELTA_HEADER_LENGTH;
+  for (uint8_t field=0; field<MAX_STATE_FIELDS; field++) {
+    if (mask & (1 << field)) {
+      length += 2;
+    }
+  }
+  if (event.dataLength != length) {
+    return false;
+  }
+
+  mirror.nodeId = event.sentFrom;
+  if (!full && (!mirror.synced || version != (uint8_t)(mirror.version + 1))) {
+    requestStateSync(mirror);
+    return false;
+  }
+
+  if (full) {
+    mirror.fieldMask = 0;
+  }
+  const uint8_t *value = &payload[STATE_DELTA_HEADER_LENGTH];
+  for (uint8_t field=0; field<MAX_STATE_FIELDS; field++) {
+    if (mask & (1 << field)) {
+      mirror.fields[field] = value[0] | (value[1] << 8);
+      value += 2;
+    }
+  }
+  mirror.fieldMask |= mask;
+  mirror.version = version;
+  mirror.synced = true;
+  mirror.syncRequestTime = 0;
+  mirror.lastUpdate = millis();
+  return true;
+}
+
+bool isRequestPending(GameRequestHandle handle) {
+  for (uint8_t i=0; i<MAX_PENDING_REQUESTS; i++) {
+    if (handle != NO_GAME_REQUEST && pendingRequests[i].handle == handle) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Forget a request. Its callback will not be called.
+ */
+void cancelRequest(GameRequestHandle handle) {
+  for (uint8_t i=0; i<MAX_PENDING_REQUESTS; i++) {
+    if (handle != NO_GAME_REQUEST && pendingRequests[i].handle == handle) {
+      pendingRequests[i].handle = NO_GAME_REQUEST;
+    }
+  }
+}
+
+/**
+ * Free the request slot and let the owner know how it went.
+ */
+void finishRequest(pendingRequestStruct *request, bool success) {
+  GameRequestHandle handle = request->handle;
+  GameRequestCallback callback = request->callback;
+  request->handle = NO_GAME_REQUEST;
+  if (callback != NULL) {
+    callback(handle, success);
+  }
+}
+
+/**
+ * Called with a freshly received eventData. If it is the response to one of our requests the request
+ * is completed and true is returned. Frames without a correlation id (legacy senders) match on the
+ * sender and the response event only.
+ *
+ * A response is a frame with a correlation id and no sequence number, requests always carry both.
+ * One that matches no pending request answers a request that has finished already, a late answer
+ * to a resend or a duplicate. It is consumed too, so the game never sees a response twice.
+ */
+bool completePendingRequest() {
+  if (eventData.sequence != 0) {
+    return false;
+  }
+  for (uint8_t i=0; i<MAX_PENDING_REQUESTS; i++) {
+    pendingRequestStruct *request = &pendingRequests[i];
+    if (request->handle != NO_GAME_REQUEST &&
+        request->nodeId == eventData.sentFrom &&
+        request->responseEvent == eventData.event &&
+        (eventData.correlationId == 0 || eventData.correlationId == request->handle)) {
+      recordRoundTrip(request->nodeId, millis() - request->sentTime);
+      finishRequest(request, true);
+      return true;
+    }
+  }
+  if (eventData.correlationId != 0) {
+#ifdef DO_COMM_UTILS_DEBUG
+    Serial.print(F("--RECV response to no pending request: "));
+    Serial.println(eventData.event);
+#endif
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Resend requests whose response is overdue, and fail the ones that are out of attempts.
+ */
+void processPendingRequests() {
+  for (uint8_t i=0; i<MAX_PENDING_REQUESTS; i++) {
+    pendingRequestStruct *request = &pendingRequests[i];
+    if (request->handle == NO_GAME_REQUEST || (millis() - request->sentTime) < responseWaitTime) {
+      continue;
+    }
+    if (request->attempts >= REQUEST_MAX_ATTEMPTS) {
+#ifdef DO_COMM_UTILS_DEBUG
+      Serial.print(F("Request failed, no response from node "));
+      Serial.println(request->nodeId);
+#endif
+      finishRequest(request, false);
+    } else {
+      Serial.println(F("RESENDING REQUEST AS NO RESPONSE RECEIVED"));
+      request->attempts++;
+      request->sentTime = millis();
+      sendPayloadToNode(request->nodeId, request->event, request->dataType, request->data,
+                        request->dataLength, request->handle, request->sequence);
+    }
+  }
+}
+
+/**
+ * Tell the controller about an important event and keep resending it until responseEvent comes back.
+ * Does not block, the optional callback is called when the exchange finishes.
+ */
+GameRequestHandle sendControllerImportantEvent(int theEvent, int responseEvent, int fromNode,
+                                               GameRequestCallback callback = NULL) {
+  return sendIntRequestToNode(GAME_CONTROLLER_NODE, theEvent, responseEvent, fromNode, callback);
+}
+
+void sendPuzzleStartSuccess() {
+  // Echo the correlation id of the controller's start request.
+  uint8_t correlationId = (eventData.sentFrom == GAME_CONTROLLER_NODE) ? eventData.correlationId : 0;
+  sendPayloadToNode(GAME_CONTROLLER_NODE, CE_PUZZLE_START_SUCCESS, GAME_PAYLOAD_NONE, NULL, 0, correlationId);
+}
+
+
+
+/**
+ *
+ */
+void respondSuccessToSender() {
+  int returnEvent = CE_ACK;
+ 
+  
+  switch(eventData.event) {
+     case CE_PLAY_TRACK:
+	   returnEvent = CE_PLAY_TRACK_SUCCESS;
+	 break;
+  }
+  Serial.println(F("Sending Success Response"));
+   replyToSender(returnEvent, "");
+   processSend();
+}
+
+/**
+ * PACKETS_BUFFER_FULL - Possible wrong bus configuration. Higher MAX_PACKETS in PJON.h if necessary.
+ */
+void error_handler(uint8_t code, uint8_t data) {
+  // For a lost connection data is the id of the device the packet was for, not a packet index.
+  if(code == PJON_CONNECTION_LOST) {
+    commStatsStruct *stats = findCommStats(data);
+    if (stats != NULL) {
+      countStat(stats->connectionLost);
+    }
+    Serial.print(F("Connection with device ID "));
+    Serial.print(data, DEC);
+    Serial.println(F(" is lost."));
+  }
+  if(code == PJON_PACKETS_BUFFER_FULL) {
+    Serial.print(F("Packet buffer full, length: "));
+    Serial.println(data, DEC);
+  }
+  if(code == PJON_CONTENT_TOO_LONG) {
+    Serial.print(F("Content too long, length: "));
+    Serial.println(data);
+  }
+}
+
+void setLocalEventHandler(void (*function)()) {
+  gameEventOccurred = function;
+}
+
+/**
+ * Route eventId to handler instead of the local event handler. Replaces any handler already registered
+ * for the id, including the built in health handlers. Pass NULL to send the id to the local event handler
+ * again. Returns false if the id is out of range or there is no room for another handler.
+ * Register after initCommunications(), which installs the built in handlers.
+ */
+bool onEvent(int eventId, GameEventHandler handler) {
+  if (eventId < FIRST_EVENT_ID || eventId > LAST_EVENT_ID) {
+    return false;
+  }
+  if (handler == NULL) {
+    eventHandlerIndex[eventId - FIRST_EVENT_ID] = 0;
+    return true;
+  }
+  // The same function registered for several ids shares one slot
+  uint8_t slot = 0;
+  while (slot < numEventHandlers && eventHandlers[slot] != handler) {
+    slot++;
+  }
+  if (slot == numEventHandlers) {
+    if (numEventHandlers == MAX_EVENT_HANDLERS) {
+#ifdef DO_COMM_UTILS_DEBUG
+      Serial.println(F("No free event handler slot."));
+#endif
+      return false;
+    }
+    eventHandlers[slot] = handler;
+    numEventHandlers++;
+  }
+  eventHandlerIndex[eventId - FIRST_EVENT_ID] = slot + 1;
+  return true;
+}
+
+/**
+ * Hand eventData to the handler registered for its id, or to the local event handler.
+ */
+void dispatchEvent() {
+  uint8_t slot = 0;
+  if (eventData.event >= FIRST_EVENT_ID && eventData.event <= LAST_EVENT_ID) {
+    slot = eventHandlerIndex[eventData.event - FIRST_EVENT_ID];
+  }
+  if (slot != 0) {
+    eventHandlers[slot - 1]();
+  } else if (gameEventOccurred != NULL) {
+    gameEventOccurred();
+  }
+}
+
+/**
+ * Built in PING handler. Answered here so health checks never reach the game code.
+ */
+void respondToPing() {
+#ifdef DO_COMM_UTILS_DEBUG
+  Serial.print(F("--PING from "));
+  Serial.println(eventData.sentFrom);
+#endif
+  replyToSender(CE_PONG, F("pong"));
+}
+
+/**
+ * Built in PONG and ACK handler. Nothing to do unless a node registers its own.
+ */
+void consumeHealthEvent() {
+#ifdef DO_COMM_UTILS_DEBUG
+  Serial.print(F("--Health event "));
+  Serial.print(eventData.event);
+  Serial.print(F(" from "));
+  Serial.println(eventData.sentFrom);
+#endif
+}
+
+/**
+ * Built in CE_REQUEST_STATS handler. Answers with the stats entry at the index asked for, or with no
+ * data once the index is past the last entry in use.
+ */
+void respondWithCommStats() {
+  const int *index = gameEventPayload<RequestStatsEvent>(eventData);
+  if (index == NULL || *index < 0 || *index >= MAX_COMM_STATS_NODES || commStats[*index].nodeId == 0) {
+    // CE_STATS without data marks the end of the list.
+    sendPayloadToNode(eventData.sentFrom, CE_STATS, GAME_PAYLOAD_NONE, NULL, 0, eventData.correlationId);
+    return;
+  }
+  commStatsStruct *stats = &commStats[*index];
+  CommStatsPayload payload;
+  payload.nodeId = stats->nodeId;
+  payload.expired = (stats->expired > 0xFF) ? 0xFF : stats->expired;
+  payload.framesSent = stats->framesSent;
+  payload.attempts = stats->attempts;
+  payload.naks = stats->naks;
+  payload.connectionLost = stats->connectionLost;
+  payload.bufferFull = stats->bufferFull;
+  payload.junkReceived = (stats->junkReceived > 0xFF) ? 0xFF : stats->junkReceived;
+  payload.eventsDropped = (stats->eventsDropped > 0xFF) ? 0xFF : stats->eventsDropped;
+  payload.rttMin = stats->rttMin;
+  payload.rttAvg = (stats->rttCount == 0) ? 0 : stats->rttTotal / stats->rttCount;
+  payload.rttMax = stats->rttMax;
+  replyGameEvent<StatsEvent>(payload);
+}
+
+/**
+ * Built in CE_REQUEST_STATE_SYNC handler. The next delta holds the whole state record and goes out
+ * without waiting for the delta interval.
+ */
+void respondToStateSync() {
+  stateFullPending = true;
+  lastStateDeltaTime = millis() - stateDeltaInterval;
+}
+
+void registerDefaultEventHandlers() {
+  onEvent(CE_REQUEST_STATS, respondWithCommStats);
+  onEvent(CE_REQUEST_STATE_SYNC, respondToStateSync);
+  onEvent(CE_PING, respondToPing);
+  onEvent(CE_PONG, consumeHealthEvent);
+  onEvent(CE_ACK, consumeHealthEvent);
+}
+
+void setLocalErrorHandler(void (*function)(uint8_t, uint8_t)) {
+  bus.set_error(function);
+}
+
+
+/**
+ * INIT Method
+ * Use initCommunications() if you are fine using the default COMM pin which is defined by COMM_PIN.
+ * Some shields (like the music maker shield) may use the default COMM_PIN for other things in which
+ * case that node should use the initOverrideComm() and pass in the pin that it wants to use.
+ * All nodes do not need to use the same pin fortunately.
+ */
+void initOverrideComm(int nodeAddress, int commAddress) {
+
+#ifdef GAME_COMM_SEND_LEGACY_FRAMES
+  // Initialize the pad buffer.
+  for (byte ii=0; ii<MAX_EVENT_DATA; ii++) {
+    padBuffer[ii] = ' ';
+  }
+#endif
+
+  thisNode = nodeAddress;
+  bus.set_id(nodeAddress);
+  bus.set_shared_network(false);
+  bus.strategy.set_pin(commAddress);
+
+// Set the Async ACK flag
+#if(INCLUDE_ASYNC_ACK)
+  bus.set_asynchronous_acknowledge(true);
+#endif
+
+  //bus.set_synchronous_acknowledge(true);
+
+  bus.begin();
+  // begin() has seeded random() from a floating analog pin, micros() adds how long start up took.
+  bootEpoch = random(0, 256) ^ (uint8_t)micros();
+  bus.set_receiver(eventReceivedFromController);
+  bus.set_error(error_handler);
+  bus.set_attempt_handler(countSendAttempt);
+  bus.include_sender_info(true);
+
+  registerDefaultEventHandlers();
+}
+
+void initCommunications(int nodeAddress) {
+  initOverrideComm(nodeAddress, COMM_PIN);
+}
 
 void setCommUtilsReceiveTimeout(int value) {
   commUtilsReceiveTimeout = value;
 }
 
+/**
+ * Change how long, in microseconds, the bus must be quiet before doComm() stops listening.
+ * Setting it to commUtilsReceiveTimeout or more gives the old always listen behaviour.
+ */
+void setCommQuietInterval(unsigned int value) {
+  commQuietMicros = value;
+}
+
+/**
+ * Change the batching window in milliseconds. 0 turns batching off.
+ */
+void setCommBatchWindow(unsigned long value) {
+  flushBatch();
+  batchWindow = value;
+}
+
 
 //GameCommUtils_h
+#ifdef GAME_COMM_NAMESPACE
+}
 #endif
 
+#endif
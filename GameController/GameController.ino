@@ -1,4 +1,9 @@
 
+#define MAX_OUTBOUND_DESTINATIONS 4
+#define OUTBOUND_QUEUE_SLOTS 6
+#define MAX_COMM_STATS_NODES 8    // The controller talks to every node
+#define MAX_RECENT_PACKET_IDS 32  // and hears from every node, so it keeps more packet ids for dedup
+#define MAX_SEQUENCE_SENDERS 8    // and gets requests from every puzzle, each needs its own window
 #include <GameCommUtils.h>
 #include <SPI.h>
 #include <RFID.h>
@@ -37,9 +42,51 @@ byte lastCardRead[5] = {1,1,1,1,1};
 unsigned long lastTimeRead;
 unsigned long delayBetweenSameCardRead = 10000;  // 10 seconds
 bool puzzleStartedSuccessfully = false;
-#define MAX_SEND_RETRYS 5     // Retry to send a message 5 times. If no success something very bad happened
+GameRequestHandle startGameRequest = NO_GAME_REQUEST;   // The START request waiting for its success response
+GameTaskHandle resetTask = NO_GAME_TASK;                // Steps through the node resets, one node at a time
+GameTaskHandle nextPuzzleTask = NO_GAME_TASK;           // Starts the next puzzle a little after one completes
+
+// The nodes the controller manages. resetAllNodes() resets them in this order, RESET_NODE_SPACING_MILLIS
+// apart, and the health monitor pings them in this order.
+int resetNodeOrder[] = { MP3_PLAYER_NODE, DOOR_KNOCKER_NODE, MASTER_MIND_POT_GAME_NODE };
+//                     FISH_SORTING_GAME_NODE, DOCK_PLANKS_GAME_NODE, LICENSE_PLATE_GAME_NODE, HELP_RADIO_NODE
+#define NUM_RESET_NODES (sizeof(resetNodeOrder) / sizeof(resetNodeOrder[0]))
+#define RESET_NODE_SPACING_MILLIS 4000
+#define NEXT_PUZZLE_DELAY_MILLIS  2000
+#define TAG_POLL_MILLIS           50
+#define STATS_COLLECT_MILLIS      300000   // Collect the comm stats of every node every 5 minutes
+
+GameRequestHandle statsRequest = NO_GAME_REQUEST;
+uint8_t statsNodeIndex = 0;      // Index in resetNodeOrder of the node being asked for its stats
+int statsEntryIndex = 0;         // Stats entry being asked for
+
+// Node health. One node is pinged every HEALTH_PING_MILLIS, round robin. A node that has not answered
+// NODE_DOWN_MISSED_PINGS pings in a row is down until it answers again. Nodes start out up.
+#define HEALTH_PING_MILLIS        1000
+#define NODE_DOWN_MISSED_PINGS    3
+
+struct nodeHealthStruct {
+  bool up = true;
+  bool pingOutstanding = false;
+  uint8_t missedPings = 0;
+  unsigned long pingSentTime = 0;
+  unsigned long lastSeen = 0;        // millis() of the last event from the node
+  unsigned int smoothedRtt = 0;      // Milliseconds, 0 until the first PONG
+};
+
+nodeHealthStruct nodeHealth[NUM_RESET_NODES];
+uint8_t healthPingIndex = 0;
+int startWaitingForNode = 0;     // Node whose start was skipped because it was down, 0 if none
+
+// Mirrors of the puzzle state records, kept current by the CE_STATE_DELTAs the puzzles push.
+#define MAX_STATE_MIRRORS 4
+puzzleStateMirrorStruct stateMirrors[MAX_STATE_MIRRORS];
 
 //#define SHOW_TAG_NUMBER 1
+//#define SHOW_DIAL_POSITION 1
+
+// Latest raw wheel position the Ship Wheel Lock reported
+int shipWheelPosition = 0;
 /* RFID Related setup
   * 3V -> VCC  NOTE 3V NOT 5V  RED
   * GND -> GND                 BLACK
@@ -67,6 +114,14 @@ void setup() {
       Serial.begin(9600);  
       setLocalEventHandler(localGameEventOccurred);
 
+      schedulePeriodic(0, commTask);
+      schedulePeriodic(TAG_POLL_MILLIS, checkForTagTask);
+      schedulePeriodic(STATS_COLLECT_MILLIS, collectNodeStats);
+      schedulePeriodic(HEALTH_PING_MILLIS, pingNextNode);
+      onEvent(CE_PONG, pongReceived);
+      onEvent(CE_STATE_DELTA, stateDeltaReceived);
+      onEvent(CE_DIAL_POSITION, dialPositionReceived);
+
       /* RFID setup */
       SPI.begin();
       rfid.init();
@@ -83,46 +138,30 @@ void setup() {
 
 
 
+// Reset every node, then start the entire game. The resets are spread out by the scheduler so
+// this returns right away.
 void resetControllerNode() {
      Serial.println("Restting Game Controller");
      currentGameState = 0;
+     puzzleStartedSuccessfully = false;
+     cancelRequest(startGameRequest);
+     cancelTask(nextPuzzleTask);
+     startWaitingForNode = 0;
 
    // playTrack("reset10");
     resetAllNodes();
-    unsigned long startTime = millis();
-    while((millis() - startTime) < 4000) {
-      doComm();                             
-    }
-    puzzleStartedSuccessfully = false;
-    sendStartGameEvent(DOOR_KNOCKER_NODE); // To start the entire game
-
 }
 
  void localGameEventOccurred() {
       debug("GOT GAME EVENT");
+      nodeSeen(eventData.sentFrom);
       switch(eventData.event) {
         case CE_RESET_NODE:
           resetControllerNode();
         break;
-        case CE_PONG:
-             Serial.print(F("++Received PONG event."));
-        break;
-        case CE_PING:
-            Serial.print(F("--Received PING event: Length: "));
-            Serial.print(strlen(eventData.data));
-            Serial.print(F(", Data: ["));
-            Serial.print(eventData.data);
-            Serial.println(F("]"));
-            sendEventToNode(eventData.sentFrom, CE_PONG, "pong");
-        break;
-        case CE_PUZZLE_START_SUCCESS:
-           puzzleStartedSuccessfully = true;
-           Serial.println(F("RECEIVED Puzzle Start Success"));
-           nextPuzzleStarted();
-        break;
         case CE_PUZZLE_COMPLETED:
            Serial.println(F("RECEIVED Puzzle Completed Event"));
-           sendEventToNode(eventData.sentFrom, CE_PUZZLE_COMPLETED_SUCCESS, "");
+           replyGameEvent<PuzzleCompletedSuccessEvent>();
            puzzleCompleted();
         break;
       }
@@ -144,8 +183,11 @@ void resetControllerNode() {
     }
 
     void puzzleCompleted() {
+      cancelTask(nextPuzzleTask);
+      nextPuzzleTask = scheduleAfter(NEXT_PUZZLE_DELAY_MILLIS, startNextPuzzle);
+    }
 
-      momentaryComm(2000);
+    void startNextPuzzle(int arg) {
       puzzleStartedSuccessfully = false;
       switch(currentGameState) {
         case 1:    // Front Door Knocker completed. 
@@ -158,35 +200,40 @@ void resetControllerNode() {
 // Tell all the nodes to reset
 void resetAllNodes() {
 //   performSend(0, CE_RESET_NODE,"");  //PJON_BROADCAST=0 but for some reason not defined here
-   doResetNode(MP3_PLAYER_NODE);
-   doResetNode(DOOR_KNOCKER_NODE);
-   doResetNode(MASTER_MIND_POT_GAME_NODE);
-//   doResetNode(FISH_SORTING_GAME_NODE);
-//   doResetNode(DOCK_PLANKS_GAME_NODE);
-//   doResetNode(LICENSE_PLATE_GAME_NODE);
-//   doResetNode(HELP_RADIO_NODE);
+   cancelTask(resetTask);
+   resetNextNode(0);
  }
 
+// Reset the node at index in resetNodeOrder and schedule the one after it. Once every node has
+// had its time to reset the game is started.
+void resetNextNode(int index) {
+   // Known dead nodes are skipped without waiting for them
+   while(index < (int)NUM_RESET_NODES && !isNodeUp(resetNodeOrder[index])) {
+     Serial.print(F("Skipping reset of down node "));
+     Serial.println(resetNodeOrder[index]);
+     index++;
+   }
+   if(index < (int)NUM_RESET_NODES) {
+     doResetNode(resetNodeOrder[index]);
+     resetTask = scheduleAfter(RESET_NODE_SPACING_MILLIS, resetNextNode, index + 1);
+   } else {
+     resetTask = NO_GAME_TASK;
+     sendStartGameEvent(DOOR_KNOCKER_NODE); // To start the entire game
+   }
+}
+
  void doResetNode(int nodeId) {
    performSend(nodeId, CE_RESET_NODE,"");
-//   delay(3000);
-   momentaryComm(4000);
- }
-
- void momentaryComm(int length) {
-   unsigned long startTime = millis();
-   while((millis() - startTime) < length) {
-      doComm();
-   }
-  
  }
 
 void loop() {
 
-   doComm();
+   runScheduler();
 
-   checkForTag();
+}
 
+void checkForTagTask(int arg) {
+   checkForTag();
 }
 
 // See if one of the known tags is detected and if so trigger the appropriate event
@@ -197,8 +244,7 @@ void checkForTag() {
       resetControllerNode();
     } else if(isDesiredTag(START_GAME)) {
      // What do we need to do to start here?
-      resetControllerNode();
-      sendStartGameEvent(DOOR_KNOCKER_NODE); // To start the entire game
+      resetControllerNode();   // Starts the entire game once the nodes are reset
     } else if(isDesiredTag(RESET_DOOR_KNOCKER_NODE)) {
        performSend(DOOR_KNOCKER_NODE,CE_RESET_NODE,"");
     } else if(isDesiredTag(RESET_AND_START_DOOR_KNOCKER_NODE)) {
@@ -303,7 +349,7 @@ bool isSameAsLastCard() {
 }
 
 
-void performSend(int node, int event, String data) {
+void performSend(int node, int event, const char *data) {
 
   if(MOCK_EVENT) {
     Serial.print("MOCK EVENT: ");
@@ -315,33 +361,219 @@ void performSend(int node, int event, String data) {
     sendEventToNode(node,event,data);
   }
 }
-// Send a start game and wait for a success message. If none happens after some time then try again
+// Send a start game request. It is resent from doComm() until the puzzle answers with a start success.
 void sendStartGameEvent(int toNode) {
-   unsigned long startTime;
-   unsigned int numberOfRetrys = 0;
-   while(!puzzleStartedSuccessfully && numberOfRetrys < MAX_SEND_RETRYS) {
-     numberOfRetrys++;
-     if(numberOfRetrys > 1) {
-        Serial.println(F("RESENDING GAME START AS NO RESPONSE"));
+   if(puzzleStartedSuccessfully || isRequestPending(startGameRequest)) {
+     return;
+   }
+   if(MOCK_EVENT) {
+     performSend(toNode, CE_START_PUZZLE, "");
+     return;
+   }
+   if(!isNodeUp(toNode)) {
+     // No point spending the retries on it. It is started as soon as it answers a ping again.
+     Serial.print(F("Start waiting for down node "));
+     Serial.println(toNode);
+     startWaitingForNode = toNode;
+     return;
+   }
+   startWaitingForNode = 0;
+   startGameRequest = sendGameRequest<StartPuzzleEvent>(toNode, startGameRequestFinished);
+}
+
+void startGameRequestFinished(GameRequestHandle handle, bool success) {
+   if(success) {
+     puzzleStartedSuccessfully = true;
+     Serial.println(F("RECEIVED Puzzle Start Success"));
+     nextPuzzleStarted();
+   } else {
+     Serial.println(F("Game Start was never answered"));
+   }
+}
+
+// Print our own comm stats, then ask each node for its stats one entry at a time.
+void collectNodeStats(int arg) {
+   if(isRequestPending(statsRequest)) {
+     return;   // Still collecting from last time
+   }
+   printNodeHealth();
+   for(int i=0; i<MAX_COMM_STATS_NODES; i++) {
+     if(commStats[i].nodeId != 0) {
+       printCommStats(GAME_CONTROLLER_NODE, commStats[i]);
+     }
+   }
+   statsNodeIndex = 0;
+   statsEntryIndex = 0;
+   requestNextStats();
+}
+
+void requestNextStats() {
+   while(statsNodeIndex < NUM_RESET_NODES && !isNodeUp(resetNodeOrder[statsNodeIndex])) {
+     statsNodeIndex++;
+   }
+   if(statsNodeIndex < NUM_RESET_NODES && !MOCK_EVENT) {
+     statsRequest = requestCommStats(resetNodeOrder[statsNodeIndex], statsEntryIndex, statsReceived);
+   }
+}
+
+void statsReceived(GameRequestHandle handle, bool success) {
+   commStatsStruct stats;
+   if(success && decodeCommStats(eventData, stats)) {
+     printCommStats(eventData.sentFrom, stats);
+     statsEntryIndex++;
+   } else {
+     statsNodeIndex++;   // Past its last entry, or the node did not answer
+     statsEntryIndex = 0;
+   }
+   requestNextStats();
+}
+
+/*******************************************************
+ * Node health
+ */
+nodeHealthStruct* findNodeHealth(int nodeId) {
+   for(uint8_t i=0; i<NUM_RESET_NODES; i++) {
+     if(resetNodeOrder[i] == nodeId) {
+       return &nodeHealth[i];
      }
-     performSend(toNode, CE_START_PUZZLE,"");
-     // now wait a specified time for a response
-     startTime = millis();
-     while(millis()-startTime < responseWaitTime && !puzzleStartedSuccessfully) {
-        doComm();
+   }
+   return NULL;
+}
+
+// Nodes the controller does not manage are always treated as up.
+bool isNodeUp(int nodeId) {
+   nodeHealthStruct* health = findNodeHealth(nodeId);
+   return health == NULL || health->up;
+}
+
+// Any event from a node proves it is alive.
+void nodeSeen(int nodeId) {
+   nodeHealthStruct* health = findNodeHealth(nodeId);
+   if(health == NULL) {
+     return;
+   }
+   health->lastSeen = millis();
+   health->missedPings = 0;
+   if(!health->up) {
+     health->up = true;
+     Serial.print(F("Node up: "));
+     Serial.println(nodeId);
+     if(startWaitingForNode == nodeId) {
+       sendStartGameEvent(nodeId);
      }
-     Serial.println(F("Finished Sending Game Start"));
    }
+}
 
-   
-  
+void pongReceived() {
+   nodeHealthStruct* health = findNodeHealth(eventData.sentFrom);
+   if(health != NULL && health->pingOutstanding) {
+     health->pingOutstanding = false;
+     unsigned int rtt = millis() - health->pingSentTime;
+     // Exponentially weighted, each new sample counts for 1/8
+     health->smoothedRtt = (health->smoothedRtt == 0) ? rtt : (health->smoothedRtt * 7 + rtt) / 8;
+   }
+   nodeSeen(eventData.sentFrom);
+}
+
+// Scheduler task. Settle the last ping to the next node in line and send it a new one.
+void pingNextNode(int arg) {
+   if(MOCK_EVENT) {
+     return;
+   }
+   int nodeId = resetNodeOrder[healthPingIndex];
+   nodeHealthStruct* health = &nodeHealth[healthPingIndex];
+   healthPingIndex = (healthPingIndex + 1) % NUM_RESET_NODES;
+
+   if(health->pingOutstanding && health->missedPings < NODE_DOWN_MISSED_PINGS) {
+     health->missedPings++;
+     if(health->missedPings == NODE_DOWN_MISSED_PINGS && health->up) {
+       health->up = false;
+       Serial.print(F("Node down: "));
+       Serial.println(nodeId);
+     }
+   }
+   health->pingOutstanding = true;
+   health->pingSentTime = millis();
+   sendEventToNode(nodeId, CE_PING);
+}
+
+void printNodeHealth() {
+   for(uint8_t i=0; i<NUM_RESET_NODES; i++) {
+     Serial.print(F("Node "));
+     Serial.print(resetNodeOrder[i]);
+     Serial.print(nodeHealth[i].up ? F(" up") : F(" DOWN"));
+     Serial.print(F(", rtt ms: "));
+     Serial.print(nodeHealth[i].smoothedRtt);
+     Serial.print(F(", last seen ms ago: "));
+     Serial.println(millis() - nodeHealth[i].lastSeen);
+   }
+}
+
+/*******************************************************
+ * Puzzle state mirrors
+ */
+puzzleStateMirrorStruct* findStateMirror(int nodeId) {
+   puzzleStateMirrorStruct* freeMirror = NULL;
+   for(uint8_t i=0; i<MAX_STATE_MIRRORS; i++) {
+     if(stateMirrors[i].nodeId == nodeId) {
+       return &stateMirrors[i];
+     }
+     if(stateMirrors[i].nodeId == 0 && freeMirror == NULL) {
+       freeMirror = &stateMirrors[i];
+     }
+   }
+   if(freeMirror != NULL) {
+     freeMirror->nodeId = nodeId;
+   }
+   return freeMirror;
+}
+
+void printStateMirror(const puzzleStateMirrorStruct &mirror) {
+   Serial.print(F("State of node "));
+   Serial.print(mirror.nodeId);
+   Serial.print(F(" v"));
+   Serial.print(mirror.version);
+   Serial.print(mirror.synced ? F(":") : F(" (syncing):"));
+   for(uint8_t field=0; field<MAX_STATE_FIELDS; field++) {
+     if(mirror.fieldMask & (1 << field)) {
+       Serial.print(' ');
+       Serial.print(mirror.fields[field]);
+     } else {
+       Serial.print(F(" -"));
+     }
+   }
+   Serial.println();
+}
+
+void stateDeltaReceived() {
+   nodeSeen(eventData.sentFrom);
+   puzzleStateMirrorStruct* mirror = findStateMirror(eventData.sentFrom);
+   if(mirror == NULL || !applyStateDelta(eventData, *mirror)) {
+     return;
+   }
+#ifdef DO_COMM_UTILS_DEBUG
+   printStateMirror(*mirror);
+#endif
+}
+
+void dialPositionReceived() {
+   nodeSeen(eventData.sentFrom);
+   const int* position = gameEventPayload<DialPositionEvent>(eventData);
+   if(position == NULL) {
+     return;
+   }
+   shipWheelPosition = *position;
+#ifdef SHOW_DIAL_POSITION
+   Serial.print(F("Dial position "));
+   Serial.println(shipWheelPosition);
+#endif
 }
 
 /***************
 * Play Track. 
 * Just a convenience to send a play track event
 **************/
-  void playTrack(String track) {
+  void playTrack(const char *track) {
 //      sendEventToController(CE_PLAY_TRACK ,rack);  
       Serial.println("Sending play track event");
       if(MOCK_EVENT) {
@@ -0,0 +1,268 @@
+#ifndef GameScheduler_h
+#define GameScheduler_h
+
+#include <Arduino.h>
+
+// Cooperative task scheduler for the game nodes.
+//
+// Instead of busy looping doComm() for a fixed time (the old momentaryComm()) a sketch schedules
+// the work it wants done later and returns to loop(). loop() only calls runScheduler().
+//
+//   scheduleAfter(10000, reportCompleted);      // Call reportCompleted(0) once, 10 seconds from now
+//   schedulePeriodic(50, pollReaders);          // Call pollReaders(0) every 50 ms
+//   schedulePeriodic(0, commTask);              // Period 0 runs the task on every scheduler pass
+//
+// Timed tasks are kept in a small timer wheel keyed on millis(). Each wheel slot covers
+// SCHEDULER_WHEEL_TICK milliseconds and holds a chain of the tasks that become due in it, so a
+// scheduler pass only looks at the slots that went by since the last pass instead of every task.
+// Tasks due more than one wheel revolution out simply stay in their slot until their time comes.
+//
+// Callbacks run from runScheduler(), never from an interrupt. A callback may schedule or cancel
+// tasks, including itself. A callback that has to wait in place (LED animations) can call
+// runSchedulerFor(), the task that is currently running is skipped by the nested passes.
+
+#ifndef MAX_SCHEDULED_TASKS
+#define MAX_SCHEDULED_TASKS 8
+#endif
+
+#define SCHEDULER_WHEEL_SLOTS 16   // Must be a power of 2
+#define SCHEDULER_WHEEL_TICK  16   // Milliseconds covered by one wheel slot
+#define SCHEDULER_WHEEL_MASK  (SCHEDULER_WHEEL_SLOTS - 1)
+
+#define NO_TASK_INDEX 0xFF
+
+// 0 is never a valid handle.
+typedef uint8_t GameTaskHandle;
+#define NO_GAME_TASK 0
+
+typedef void (*GameTaskCallback)(int arg);
+
+struct scheduledTaskStruct {
+  GameTaskHandle handle = NO_GAME_TASK;   // NO_GAME_TASK if this entry is free
+  GameTaskCallback callback = NULL;
+  int arg = 0;
+  unsigned long dueTime = 0;
+  unsigned long period = 0;               // 0 for a one shot task, or an every pass task if everyPass is set
+  bool everyPass = false;
+  bool running = false;                   // Callback is on the stack, skip it in nested passes
+  uint8_t nextInSlot = NO_TASK_INDEX;     // Next task in the same wheel slot
+};
+
+scheduledTaskStruct scheduledTasks[MAX_SCHEDULED_TASKS];
+uint8_t schedulerWheel[SCHEDULER_WHEEL_SLOTS] = { NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX,
+                                                  NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX,
+                                                  NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX,
+                                                  NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX, NO_TASK_INDEX };
+unsigned long schedulerLastTick = 0;     // Last wheel tick whose tasks have all run
+bool schedulerStarted = false;
+GameTaskHandle lastTaskHandle = NO_GAME_TASK;
+
+// How late the latest timed task ran, in milliseconds. This is the responsiveness of the node,
+// a blocking callback anywhere shows up here. Clear it to start a new measurement.
+unsigned long schedulerMaxLateMillis = 0;
+
+int findTask(GameTaskHandle handle) {
+  if (handle == NO_GAME_TASK) {
+    return -1;
+  }
+  for (int i = 0; i < MAX_SCHEDULED_TASKS; i++) {
+    if (scheduledTasks[i].handle == handle) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Link a timed task into the wheel slot for its due time. A task that is already due goes into the
+ * next slot the scheduler will look at.
+ */
+void linkTaskIntoWheel(uint8_t index) {
+  unsigned long dueTick = scheduledTasks[index].dueTime / SCHEDULER_WHEEL_TICK;
+  if ((long)(dueTick - schedulerLastTick) <= 0) {
+    dueTick = schedulerLastTick + 1;
+  }
+  uint8_t slot = dueTick & SCHEDULER_WHEEL_MASK;
+  scheduledTasks[index].nextInSlot = schedulerWheel[slot];
+  schedulerWheel[slot] = index;
+}
+
+void unlinkTaskFromWheel(uint8_t index) {
+  for (uint8_t slot = 0; slot < SCHEDULER_WHEEL_SLOTS; slot++) {
+    uint8_t* link = &schedulerWheel[slot];
+    while (*link != NO_TASK_INDEX) {
+      if (*link == index) {
+        *link = scheduledTasks[index].nextInSlot;
+        scheduledTasks[index].nextInSlot = NO_TASK_INDEX;
+        return;
+      }
+      link = &scheduledTasks[*link].nextInSlot;
+    }
+  }
+}
+
+GameTaskHandle addTask(unsigned long delayMillis, unsigned long period, bool everyPass, GameTaskCallback callback, int arg) {
+  if (callback == NULL) {
+    return NO_GAME_TASK;
+  }
+  if (!schedulerStarted) {
+    schedulerLastTick = millis() / SCHEDULER_WHEEL_TICK;
+    schedulerStarted = true;
+  }
+  for (uint8_t i = 0; i < MAX_SCHEDULED_TASKS; i++) {
+    scheduledTaskStruct* task = &scheduledTasks[i];
+    if (task->handle != NO_GAME_TASK || task->running) {
+      continue;
+    }
+    do {
+      lastTaskHandle++;
+    } while (lastTaskHandle == NO_GAME_TASK || findTask(lastTaskHandle) >= 0);
+
+    task->handle = lastTaskHandle;
+    task->callback = callback;
+    task->arg = arg;
+    task->period = period;
+    task->everyPass = everyPass;
+    task->nextInSlot = NO_TASK_INDEX;
+    if (!everyPass) {
+      task->dueTime = millis() + delayMillis;
+      linkTaskIntoWheel(i);
+    }
+    return task->handle;
+  }
+#ifdef DO_COMM_UTILS_DEBUG
+  Serial.println(F("No free task slot."));
+#endif
+  return NO_GAME_TASK;
+}
+
+/**
+ * Call callback(arg) once, delayMillis from now. Returns NO_GAME_TASK if the task table is full.
+ */
+GameTaskHandle scheduleAfter(unsigned long delayMillis, GameTaskCallback callback, int arg = 0) {
+  return addTask(delayMillis, 0, false, callback, arg);
+}
+
+/**
+ * Call callback(arg) every periodMillis. A period of 0 calls it on every scheduler pass, which is
+ * what doComm() and reader polling want.
+ */
+GameTaskHandle schedulePeriodic(unsigned long periodMillis, GameTaskCallback callback, int arg = 0) {
+  return addTask(periodMillis, periodMillis, periodMillis == 0, callback, arg);
+}
+
+bool isTaskScheduled(GameTaskHandle handle) {
+  return findTask(handle) >= 0;
+}
+
+/**
+ * Stop a task. It is safe to cancel a task that already ran or was never scheduled.
+ */
+bool cancelTask(GameTaskHandle handle) {
+  int index = findTask(handle);
+  if (index < 0) {
+    return false;
+  }
+  if (!scheduledTasks[index].everyPass) {
+    unlinkTaskFromWheel(index);
+  }
+  scheduledTasks[index].handle = NO_GAME_TASK;
+  scheduledTasks[index].callback = NULL;
+  return true;
+}
+
+void runTask(uint8_t index) {
+  scheduledTaskStruct* task = &scheduledTasks[index];
+  GameTaskHandle handle = task->handle;
+  task->running = true;
+  task->callback(task->arg);
+  task->running = false;
+
+  // The callback may have cancelled its own task
+  if (task->handle != handle || task->everyPass) {
+    return;
+  }
+  if (task->period == 0) {
+    task->handle = NO_GAME_TASK;
+    task->callback = NULL;
+    return;
+  }
+  task->dueTime += task->period;
+  unsigned long now = millis();
+  if ((long)(now - task->dueTime) >= 0) {
+    // Fell more than a period behind. Skip the missed runs rather than running them back to back.
+    task->dueTime = now + task->period;
+  }
+  linkTaskIntoWheel(index);
+}
+
+/**
+ * Run the due tasks in one wheel slot. The chain is walked from the head again after every callback
+ * because the callback may have changed it.
+ */
+void runWheelSlot(uint8_t slot, unsigned long now) {
+  bool ranOne = true;
+  while (ranOne) {
+    ranOne = false;
+    uint8_t* link = &schedulerWheel[slot];
+    while (*link != NO_TASK_INDEX) {
+      uint8_t index = *link;
+      scheduledTaskStruct* task = &scheduledTasks[index];
+      long late = (long)(now - task->dueTime);
+      if (late >= 0) {
+        *link = task->nextInSlot;
+        task->nextInSlot = NO_TASK_INDEX;
+        if ((unsigned long)late > schedulerMaxLateMillis) {
+          schedulerMaxLateMillis = late;
+        }
+        runTask(index);
+        ranOne = true;
+        break;
+      }
+      link = &task->nextInSlot;
+    }
+  }
+}
+
+/**
+ * One scheduler pass. Call this from loop() and nothing else.
+ */
+void runScheduler() {
+  unsigned long now = millis();
+
+  for (uint8_t i = 0; i < MAX_SCHEDULED_TASKS; i++) {
+    if (scheduledTasks[i].everyPass && scheduledTasks[i].handle != NO_GAME_TASK && !scheduledTasks[i].running) {
+      runTask(i);
+    }
+  }
+
+  if (!schedulerStarted) {
+    return;
+  }
+  unsigned long nowTick = now / SCHEDULER_WHEEL_TICK;
+  if ((long)(nowTick - schedulerLastTick) > SCHEDULER_WHEEL_SLOTS) {
+    // Away for more than a full revolution, every slot needs a look but only once.
+    schedulerLastTick = nowTick - SCHEDULER_WHEEL_SLOTS;
+  }
+  // Ticks up to schedulerLastTick are done. The tick after it is still filling up, so it is looked
+  // at on every pass but only counted as done once millis() has moved past it.
+  // schedulerLastTick is global so a nested pass started by a callback moves this pass along too.
+  while ((long)(nowTick - schedulerLastTick) > 1) {
+    schedulerLastTick++;
+    runWheelSlot(schedulerLastTick & SCHEDULER_WHEEL_MASK, now);
+  }
+  runWheelSlot((schedulerLastTick + 1) & SCHEDULER_WHEEL_MASK, now);
+}
+
+/**
+ * Keep the scheduler running for howLong milliseconds before returning. Only for code that really
+ * has to wait in place, everything else should use scheduleAfter().
+ */
+void runSchedulerFor(unsigned long howLong) {
+  unsigned long start = millis();
+  while ((millis() - start) < howLong) {
+    runScheduler();
+  }
+}
+
+#endif
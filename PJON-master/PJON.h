@@ -74,7 +74,8 @@ limitations under the License. */
   #include "strategies/SoftwareBitBang/SoftwareBitBang.h"
   #include "strategies/ThroughSerial/ThroughSerial.h"
   /* Avoid ATtiny 45/85 error missing inclusion error */
-  #if !defined(__AVR_ATtiny45__) && !defined(__AVR_ATtiny85__)
+  /* Avoid missing Ethernet library where it is not wanted (PJON_NO_ETHERNET) */
+  #if !defined(__AVR_ATtiny45__) && !defined(__AVR_ATtiny85__) && !defined(PJON_NO_ETHERNET)
     #include "strategies/EthernetTCP/EthernetTCP.h"
     #include "strategies/LocalUDP/LocalUDP.h"
   #endif
@@ -154,6 +155,27 @@ limitations under the License. */
         uint16_t header = NOT_ASSIGNED,
         uint16_t p_id = 0
       ) {
+        PacketFragment fragment = {source, length};
+        return compose_fragments(id, b_id, destination, &fragment, 1, header, p_id);
+      };
+
+
+      /* Compose a packet whose content is the fragments one after the other.
+         Each fragment is copied once, straight into destination, and the CRC
+         is computed along the way: */
+
+      uint16_t compose_fragments(
+        const uint8_t id,
+        const uint8_t *b_id,
+        char *destination,
+        const PacketFragment *fragments,
+        uint8_t fragment_count,
+        uint16_t header = NOT_ASSIGNED,
+        uint16_t p_id = 0
+      ) {
+        uint16_t length = 0;
+        for(uint8_t f = 0; f < fragment_count; f++)
+          length += fragments[f].length;
         if(header == NOT_ASSIGNED) header = config;
         if(header > 255) header |= EXTEND_HEADER_BIT;
         if(length > 255) header |= (EXTEND_LENGTH_BIT | CRC_BIT);
@@ -202,14 +224,25 @@ limitations under the License. */
           #endif
         }
 
-        memcpy(destination + (new_length - length - (header & CRC_BIT ? 4 : 1)), source, length);
+        uint16_t offset = new_length - length - (header & CRC_BIT ? 4 : 1);
+        uint32_t CRC = (header & CRC_BIT) ?
+          crc32::compute((uint8_t *)destination, offset) :
+          crc8::compute((uint8_t *)destination, offset);
+        for(uint8_t f = 0; f < fragment_count; f++) {
+          const uint8_t *source = (const uint8_t *)fragments[f].data;
+          if(!fragments[f].length) continue;
+          memcpy(destination + offset, source, fragments[f].length);
+          if(header & CRC_BIT)
+            CRC = crc32::compute(source, fragments[f].length, CRC);
+          else CRC = crc8::compute(source, fragments[f].length, CRC);
+          offset += fragments[f].length;
+        }
         if(header & CRC_BIT) {
-          uint32_t CRC = crc32::compute((uint8_t *)destination, new_length - 4);
           destination[new_length - 4] = (uint32_t)(CRC) >> 24;
           destination[new_length - 3] = (uint32_t)(CRC) >> 16;
           destination[new_length - 2] = (uint32_t)(CRC) >>  8;
           destination[new_length - 1] = (uint32_t)(CRC);
-        } else destination[new_length - 1] = crc8::compute((uint8_t *)destination, new_length - 1);
+        } else destination[new_length - 1] = CRC;
         return new_length;
       };
 
@@ -232,20 +265,48 @@ limitations under the License. */
         uint16_t header = NOT_ASSIGNED,
         uint16_t p_id = 0
       ) {
-        for(uint8_t i = 0; i < MAX_PACKETS; i++)
-          if(packets[i].state == 0) {
-            if(!(length = compose_packet(
-              id, b_id, packets[i].content, packet, length, header, p_id
-            ))) return FAIL;
-            packets[i].length = length;
-            packets[i].state = TO_BE_SENT;
-            packets[i].registration = micros();
-            packets[i].timing = timing;
-            return i;
-          }
+        PacketFragment fragment = {packet, length};
+        return dispatch_fragments(id, b_id, &fragment, 1, timing, header, p_id);
+      };
+
+
+      /* Add a packet made of fragments to the send list, see compose_fragments: */
 
-        _error(PACKETS_BUFFER_FULL, MAX_PACKETS);
-        return FAIL;
+      uint16_t dispatch_fragments(
+        uint8_t id,
+        const uint8_t *b_id,
+        const PacketFragment *fragments,
+        uint8_t fragment_count,
+        uint32_t timing,
+        uint16_t header = NOT_ASSIGNED,
+        uint16_t p_id = 0
+      ) {
+        if(!_free_count) {
+          _error(PACKETS_BUFFER_FULL, MAX_PACKETS);
+          return FAIL;
+        }
+        uint8_t i = _free_slots[_free_count - 1];
+        uint16_t length = compose_fragments(
+          id, b_id, packets[i].content, fragments, fragment_count, header, p_id
+        );
+        if(!length) return FAIL;
+        _free_count--;
+        _packets_count++;
+        packets[i].length = length;
+        packets[i].state = TO_BE_SENT;
+        packets[i].registration = micros();
+        packets[i].timing = timing;
+        #if(INCLUDE_ASYNC_ACK)
+          PacketInfo info;
+          parse((uint8_t *)packets[i].content, info);
+          _packet_ids[i] = info.id;
+        #endif
+        #if(ORDERED_SENDING)
+          link_to_receiver_tail(i);
+          if(_previous_for_receiver[i] != NO_SLOT) return i;
+        #endif
+        schedule(i);
+        return i;
       };
 
 
@@ -323,10 +384,21 @@ limitations under the License. */
         bool CRC = 0;
         bool extended_header = false;
         bool extended_length = false;
+        /* The CRC is computed while the bytes arrive, in the gap before the
+           next one, so ACK or NAK can be sent as soon as the last byte is in */
+        uint8_t crc_8 = 0;
+        uint32_t crc_32 = 0xFFFFFFFF;
         for(uint16_t i = 0; i < length; i++) {
           data[i] = state = strategy.receive_byte();
           if(state == FAIL) return FAIL;
 
+          /* CRC8 covers every byte including itself and ends at 0. CRC32 lags
+             4 bytes behind, so it never covers the 4 CRC bytes at the end. */
+          if(i < 2 || !(data[1] & CRC_BIT))
+            crc_8 = crc8::roll(data[i], crc_8);
+          else if(i >= 4)
+            crc_32 = crc32::roll(data[i - 4], crc_32);
+
           if(i == 0)
             if(data[i] != _device_id && data[i] != BROADCAST && !_router)
               return BUSY;
@@ -356,8 +428,8 @@ limitations under the License. */
         }
 
         if(data[1] & CRC_BIT)
-          CRC = crc32::compare(crc32::compute(data, length - 4), data + (length - 4));
-        else CRC = !crc8::compute(data, length);
+          CRC = crc32::compare(~crc_32, data + (length - 4));
+        else CRC = !crc_8;
 
         if(data[1] & ACK_REQUEST_BIT && data[0] != BROADCAST)
           if(_mode != SIMPLEX && !_router)
@@ -421,6 +493,14 @@ limitations under the License. */
       /* Remove a packet from the send list: */
 
       void remove(uint16_t index) {
+        if(packets[index].state != 0) {
+          unschedule(index);
+          #if(ORDERED_SENDING)
+            unlink_from_receiver(index);
+          #endif
+          _free_slots[_free_count++] = index;
+          _packets_count--;
+        }
         packets[index].attempts = 0;
         packets[index].length = 0;
         packets[index].registration = 0;
@@ -428,33 +508,41 @@ limitations under the License. */
       };
 
 
-      /* Remove a packet from the packet's buffer passing its id as reference: */
+      /* Remove a packet from the packet's buffer passing its id as reference.
+         Only the ids recorded at dispatch are scanned, a header is parsed for
+         the packet that matches alone: */
 
       boolean handle_asynchronous_acknowledgment(PacketInfo packet_info) {
-        PacketInfo actual_info;
-        for(uint8_t i = 0; i < MAX_PACKETS; i++) {
-          parse((uint8_t *)packets[i].content, actual_info);
-          if(actual_info.id == packet_info.id)
-            if(actual_info.receiver_id == packet_info.sender_id && (
-              (!(actual_info.header & MODE_BIT) && !(packet_info.header & MODE_BIT)) ? true :
-                bus_id_equality(actual_info.receiver_bus_id, packet_info.sender_bus_id)
-            )) {
-              if(packets[i].timing) {
-                uint8_t offset = packet_overhead(actual_info.header);
-                uint8_t crc_offset = ((actual_info.header & CRC_BIT) ? 4 : 1);
-                dispatch(
-                  actual_info.receiver_id,
-                  (uint8_t *)actual_info.receiver_bus_id,
-                  packets[i].content + (offset - crc_offset),
-                  packets[i].length - offset,
-                  packets[i].timing,
-                  actual_info.header
-                );
-              }
-              remove(i);
-              return true;
+        #if(INCLUDE_ASYNC_ACK)
+          for(uint8_t i = 0; i < MAX_PACKETS; i++) {
+            if(packets[i].state == 0 || _packet_ids[i] != packet_info.id) continue;
+            const uint8_t *content = (const uint8_t *)packets[i].content;
+            if(content[0] != packet_info.sender_id) continue;
+            if((content[1] & MODE_BIT) || (packet_info.header & MODE_BIT))
+              if(!bus_id_equality(
+                (content[1] & MODE_BIT) ? content + 3 +
+                  ((content[1] & EXTEND_HEADER_BIT) ? 1 : 0) +
+                  ((content[1] & EXTEND_LENGTH_BIT) ? 1 : 0) : localhost,
+                packet_info.sender_bus_id
+              )) continue;
+            if(packets[i].timing) {
+              PacketInfo actual_info;
+              parse(content, actual_info);
+              uint8_t offset = packet_overhead(actual_info.header);
+              uint8_t crc_offset = ((actual_info.header & CRC_BIT) ? 4 : 1);
+              dispatch(
+                actual_info.receiver_id,
+                (uint8_t *)actual_info.receiver_bus_id,
+                packets[i].content + (offset - crc_offset),
+                packets[i].length - offset,
+                packets[i].timing,
+                actual_info.header
+              );
             }
-        }
+            remove(i);
+            return true;
+          }
+        #endif
         return false;
       };
 
@@ -507,7 +595,30 @@ limitations under the License. */
       };
 
 
-      /* IMPORTANT: send_repeatedly timing maximum is 4293014170 microseconds or 71.55 minutes */
+      /* Send a packet made of fragments, see compose_fragments: */
+
+      uint16_t send_fragments(
+        uint8_t id,
+        const PacketFragment *fragments,
+        uint8_t fragment_count,
+        uint16_t header = NOT_ASSIGNED
+      ) {
+        return dispatch_fragments(id, bus_id, fragments, fragment_count, 0, header);
+      };
+
+
+      uint16_t send_fragments(
+        uint8_t id,
+        const uint8_t *b_id,
+        const PacketFragment *fragments,
+        uint8_t fragment_count,
+        uint16_t header = NOT_ASSIGNED
+      ) {
+        return dispatch_fragments(id, b_id, fragments, fragment_count, 0, header);
+      };
+
+
+      /* IMPORTANT: send_repeatedly timing maximum is 2147483647 microseconds or 35.79 minutes */
       uint16_t send_repeatedly(
         uint8_t id,
         const char *string,
@@ -519,7 +630,7 @@ limitations under the License. */
       };
 
 
-      /* IMPORTANT: send_repeatedly timing maximum is 4293014170 microseconds or 71.55 minutes */
+      /* IMPORTANT: send_repeatedly timing maximum is 2147483647 microseconds or 35.79 minutes */
       uint16_t send_repeatedly(
         uint8_t id,
         const uint8_t *b_id,
@@ -546,12 +657,11 @@ limitations under the License. */
       };
 
 
-      /* Compose and send a packet passing its info as parameters: */
+      /* Compose and send a packet passing its info as parameters. The packet
+         is composed in a free slot of the send list, see borrow_free_slot: */
 
       uint16_t send_packet(uint8_t id, char *string, uint16_t length, uint16_t header = NOT_ASSIGNED) {
-        if(!(length = compose_packet(id, bus_id, (char *)data, string, length, header)))
-          return FAIL;
-        return send_packet((char *)data, length);
+        return send_packet(id, bus_id, string, length, header);
       };
 
 
@@ -562,9 +672,10 @@ limitations under the License. */
         uint16_t length,
         uint16_t header = NOT_ASSIGNED
       ) {
-        if(!(length = compose_packet(id, b_id, (char *)data, string, length, header)))
+        char *packet = borrow_free_slot();
+        if(!packet || !(length = compose_packet(id, b_id, packet, string, length, header)))
           return FAIL;
-        return send_packet((char *)data, length);
+        return send_packet(packet, length);
       };
 
 
@@ -580,10 +691,11 @@ limitations under the License. */
         uint16_t header = NOT_ASSIGNED,
         uint32_t timeout = 3000000
       ) {
-        if(!(length = compose_packet(
+        char *packet = borrow_free_slot();
+        if(!packet || !(length = compose_packet(
           id,
           b_id,
-          (char *)data,
+          packet,
           string,
           length,
           header
@@ -595,7 +707,7 @@ limitations under the License. */
           (state != ACK) && (attempts <= strategy.get_max_attempts()) &&
           (uint32_t)(micros() - start) <= timeout
         ) {
-          state = send_packet((char*)data, length);
+          state = send_packet(packet, length);
           if(state == ACK) return state;
           attempts++;
           if(state != FAIL) strategy.handle_collision();
@@ -672,10 +784,25 @@ limitations under the License. */
         if(!bus_id_equality(bus_id, localhost)) set_shared_network(true);
         set_error(dummy_error_handler);
         set_receiver(dummy_receiver_handler);
-        for(int i = 0; i < MAX_PACKETS; i++) {
+        set_attempt_handler(dummy_attempt_handler);
+        _due_count = 0;
+        _free_count = 0;
+        _packets_count = 0;
+        #if(INCLUDE_ASYNC_ACK)
+          _recent_head = 0;
+          _recent_count = 0;
+          memset(_recent_id_table, NO_SLOT, RECENT_ID_TABLE_LENGTH);
+        #endif
+        for(int i = MAX_PACKETS - 1; i >= 0; i--) {
           packets[i].state = 0;
           packets[i].timing = 0;
           packets[i].attempts = 0;
+          _due_position[i] = NOT_SCHEDULED;
+          #if(ORDERED_SENDING)
+            _previous_for_receiver[i] = NO_SLOT;
+            _next_for_receiver[i] = NO_SLOT;
+          #endif
+          _free_slots[_free_count++] = i;
         }
       };
 
@@ -696,6 +823,22 @@ limitations under the License. */
       };
 
 
+      /* Pass a void function to be called after every attempt update() makes
+         to send a packet, with the packet's index and the response (ACK, NAK,
+         FAIL or BUSY). It lets the caller count attempts without looking at
+         the send list:
+
+      void attempt_handler(uint16_t index, uint16_t response) {
+        if(response == NAK) naks[bus.packets[index].content[0]]++;
+      };
+
+      bus.set_attempt_handler(attempt_handler); */
+
+      void set_attempt_handler(attempt_handler a) {
+        _attempt_handler = a;
+      };
+
+
       /* Set the device id, passing a single byte (watch out to id collision): */
 
       void set_id(uint8_t id) {
@@ -772,11 +915,24 @@ limitations under the License. */
          Returns the actual number of packets to be sent. */
 
       uint8_t update() {
-        uint8_t packets_count = 0;
-        for(uint8_t i = 0; i < MAX_PACKETS; i++) {
-          if(packets[i].state == 0) continue;
-          packets_count++;
+        /* Take every packet whose time has come off the due queue first, the
+           ones still in the send list afterwards go back in with their new
+           due time. Packets that are not due are never looked at. */
+        uint32_t now = micros();
+        uint8_t due[MAX_PACKETS];
+        uint8_t due_count = 0;
+        while(_due_count && (int32_t)(now - _due_time[_due_queue[0]]) > 0) {
+          due[due_count++] = _due_queue[0];
+          unschedule(_due_queue[0]);
+        }
 
+        for(uint8_t d = 0; d < due_count; d++) {
+          uint8_t i = due[d];
+          /* The error handler called for an earlier due packet may have
+             removed this one and dispatched another into its slot. That one
+             is queued already if it is first to its receiver, otherwise it
+             waits behind the packets to its receiver and is not sent. */
+          if(packets[i].state == 0 || _due_position[i] != NOT_SCHEDULED) continue;
           #if(ORDERED_SENDING)
             if(!first_packet_to_be_sent(i)) continue;
           #endif
@@ -784,12 +940,12 @@ limitations under the License. */
           bool async_ack = (packets[i].content[1] & ACK_MODE_BIT) &&
             (packets[i].content[1] & SENDER_INFO_BIT);
 
-          if(
-            (uint32_t)(micros() - packets[i].registration) >
-            (uint32_t)(packets[i].timing + strategy.back_off(packets[i].attempts))
-          ) packets[i].state = send_packet(packets[i].content, packets[i].length);
-          else continue;
-
+          uint16_t state = send_packet(packets[i].content, packets[i].length);
+          _attempt_handler(i, state);
+          /* An acknowledgment received while sending may have removed the
+             packet, and the slot may hold a new one already */
+          if(packets[i].state == 0 || _due_position[i] != NOT_SCHEDULED) continue;
+          packets[i].state = state;
           packets[i].attempts++;
 
           if(packets[i].state == ACK) {
@@ -798,14 +954,14 @@ limitations under the License. */
                 _auto_delete && (
                   (packets[i].length == packet_overhead(packets[i].content[1]) && async_ack
                 ) || !(packets[i].content[1] & ACK_MODE_BIT))
-              ) {
-                remove(i);
-                packets_count--;
-              }
+              ) remove(i);
             } else {
               packets[i].attempts = 0;
               packets[i].registration = micros();
               packets[i].state = TO_BE_SENT;
+              #if(ORDERED_SENDING)
+                requeue_for_receiver(i);
+              #endif
             } if(!async_ack) continue;
           }
 
@@ -814,36 +970,37 @@ limitations under the License. */
           if(packets[i].attempts > strategy.get_max_attempts()) {
             _error(CONNECTION_LOST, packets[i].content[0]);
             if(!packets[i].timing) {
-              if(_auto_delete) {
-                remove(i);
-                packets_count--;
-              }
+              if(_auto_delete) remove(i);
             } else {
               packets[i].attempts = 0;
               packets[i].registration = micros();
               packets[i].state = TO_BE_SENT;
+              #if(ORDERED_SENDING)
+                requeue_for_receiver(i);
+              #endif
             }
           }
         }
-        return packets_count;
+
+        /* A slot removed and dispatched again meanwhile is already queued, one
+           behind another packet to its receiver is queued when it is first */
+        for(uint8_t d = 0; d < due_count; d++)
+          if(packets[due[d]].state != 0 && _due_position[due[d]] == NOT_SCHEDULED)
+            #if(ORDERED_SENDING)
+              if(first_packet_to_be_sent(due[d]))
+            #endif
+            schedule(due[d]);
+        return _packets_count;
       };
 
 
-      /* Check if the packet index passed is the first to be sent: */
+      #if(ORDERED_SENDING)
+        /* Check if the packet index passed is the first to be sent to its receiver: */
 
-      boolean first_packet_to_be_sent(uint8_t index) {
-        PacketInfo actual_info;
-        PacketInfo tested_info;
-        parse((uint8_t *)packets[index].content, actual_info);
-        for(uint8_t i = 0; i < MAX_PACKETS; i++) {
-          parse((uint8_t *)packets[i].content, tested_info);
-          if(
-            actual_info.receiver_id == tested_info.receiver_id &&
-            bus_id_equality(actual_info.receiver_bus_id, tested_info.receiver_bus_id)
-          ) if(packets[i].registration < packets[index].registration) return false;
-        }
-        return true;
-      };
+        boolean first_packet_to_be_sent(uint8_t index) const {
+          return _previous_for_receiver[index] == NO_SLOT;
+        };
+      #endif
 
 
       /* Check if the packet id and its transmitter info are already present in the
@@ -851,32 +1008,34 @@ limitations under the License. */
 
       bool known_packet_id(PacketInfo info) {
         #if(INCLUDE_ASYNC_ACK)
-          for(uint8_t i = 0; i < MAX_RECENT_PACKET_IDS; i++)
-            if(
-              info.id == recent_packet_ids[i].id &&
-              info.sender_id == recent_packet_ids[i].sender_id &&
-              ((
-                (info.header & MODE_BIT) && (recent_packet_ids[i].header & MODE_BIT) &&
-                bus_id_equality((uint8_t *)info.sender_bus_id, (uint8_t *)recent_packet_ids[i].sender_bus_id)
-              ) || !(info.header & MODE_BIT) && !(recent_packet_ids[i].header & MODE_BIT))
-            ) return true;
+          for(
+            uint16_t h = recent_id_hash(info);
+            _recent_id_table[h] != NO_SLOT;
+            h = (h + 1) & (RECENT_ID_TABLE_LENGTH - 1)
+          ) if(same_sender_and_id(recent_packet_ids[_recent_id_table[h]], info)) return true;
 
           save_packet_id(info);
-          return false;
         #endif
+        return false;
       };
 
 
-      /* Save packet id in the buffer: */
+      /* Save packet id in the buffer. recent_packet_ids is a ring, the new id
+         takes the place of the oldest one once it is full: */
 
       void save_packet_id(PacketInfo info) {
         #if(INCLUDE_ASYNC_ACK)
-          for(uint8_t i = MAX_RECENT_PACKET_IDS - 1; i > 0; i--)
-            recent_packet_ids[i] = recent_packet_ids[i - 1];
-          recent_packet_ids[0].id = info.id;
-          recent_packet_ids[0].header = info.header;
-          recent_packet_ids[0].sender_id = info.sender_id;
-          copy_bus_id(recent_packet_ids[0].sender_bus_id, info.sender_bus_id);
+          if(_recent_count == MAX_RECENT_PACKET_IDS) forget_recent_id(_recent_head);
+          else _recent_count++;
+          PJON_Packet_Record &record = recent_packet_ids[_recent_head];
+          record.id = info.id;
+          record.header = info.header;
+          record.sender_id = info.sender_id;
+          copy_bus_id(record.sender_bus_id, info.sender_bus_id);
+          uint16_t h = recent_id_hash(info);
+          while(_recent_id_table[h] != NO_SLOT) h = (h + 1) & (RECENT_ID_TABLE_LENGTH - 1);
+          _recent_id_table[h] = _recent_head;
+          _recent_head = (_recent_head + 1) % MAX_RECENT_PACKET_IDS;
         #endif
       };
 
@@ -894,6 +1053,181 @@ limitations under the License. */
       static void copy_bus_id(uint8_t dest[], const uint8_t src[]) { memcpy(dest, src, 4); };
 
     private:
+      /* Send list bookkeeping. _due_queue is a binary min-heap of the slots
+         in use ordered by the time they are due to be sent, _due_position is
+         where each slot is in it. _free_slots is a stack of the free slots. */
+      uint32_t  _due_time[MAX_PACKETS];
+      uint8_t   _due_queue[MAX_PACKETS];
+      uint8_t   _due_position[MAX_PACKETS];
+      uint8_t   _due_count;
+      uint8_t   _free_slots[MAX_PACKETS];
+      uint8_t   _free_count;
+      uint8_t   _packets_count;
+
+      /* Due times are compared as a signed difference so micros() overflow
+         is handled, which limits timing to 2147483647 microseconds */
+      bool due_before(uint8_t a, uint8_t b) const {
+        return (int32_t)(_due_time[_due_queue[a]] - _due_time[_due_queue[b]]) < 0;
+      };
+
+      void swap_due(uint8_t a, uint8_t b) {
+        uint8_t slot = _due_queue[a];
+        _due_queue[a] = _due_queue[b];
+        _due_queue[b] = slot;
+        _due_position[_due_queue[a]] = a;
+        _due_position[_due_queue[b]] = b;
+      };
+
+      void sift_due(uint8_t position) {
+        while(position && due_before(position, (position - 1) / 2)) {
+          swap_due(position, (position - 1) / 2);
+          position = (position - 1) / 2;
+        }
+        while(true) {
+          uint8_t first = position;
+          uint8_t left = 2 * position + 1;
+          if(left < _due_count && due_before(left, first)) first = left;
+          if(left + 1 < _due_count && due_before(left + 1, first)) first = left + 1;
+          if(first == position) return;
+          swap_due(position, first);
+          position = first;
+        }
+      };
+
+      /* Queue a slot to be sent once its timing and back off have passed */
+      /* Packets sent right away are composed in the content of a free slot,
+         which is not queued and only used until the call returns. Nothing
+         that sending calls takes a slot, so it stays free meanwhile. This
+         costs no RAM, not even stack, and never touches data, so a send from
+         the receiver function does not overwrite the packet being read. The
+         send fails if the send list is full. */
+      char *borrow_free_slot() {
+        if(!_free_count) {
+          _error(PACKETS_BUFFER_FULL, MAX_PACKETS);
+          return NULL;
+        }
+        return packets[_free_slots[_free_count - 1]].content;
+      };
+
+      void schedule(uint8_t index) {
+        _due_time[index] = packets[index].registration + packets[index].timing +
+          strategy.back_off(packets[index].attempts);
+        _due_queue[_due_count] = index;
+        _due_position[index] = _due_count;
+        sift_due(_due_count++);
+      };
+
+      void unschedule(uint8_t index) {
+        uint8_t position = _due_position[index];
+        if(position == NOT_SCHEDULED) return;
+        _due_position[index] = NOT_SCHEDULED;
+        if(position == --_due_count) return;
+        _due_queue[position] = _due_queue[_due_count];
+        _due_position[_due_queue[position]] = position;
+        sift_due(position);
+      };
+
+      #if(INCLUDE_ASYNC_ACK)
+        /* Id of the packet in each slot, 0 if it has none */
+        uint16_t _packet_ids[MAX_PACKETS];
+
+        /* Open addressed hash table, with linear probing, of the places in
+           recent_packet_ids, NO_SLOT where free */
+        uint8_t _recent_id_table[RECENT_ID_TABLE_LENGTH];
+        uint8_t _recent_head;
+        uint8_t _recent_count;
+
+        static bool same_sender_and_id(const PJON_Packet_Record &record, const PacketInfo &info) {
+          if(record.id != info.id || record.sender_id != info.sender_id) return false;
+          if((record.header & MODE_BIT) != (info.header & MODE_BIT)) return false;
+          return !(info.header & MODE_BIT) ||
+            bus_id_equality(record.sender_bus_id, info.sender_bus_id);
+        };
+
+        template<typename Record>
+        static uint16_t recent_id_hash(const Record &record) {
+          uint16_t h = record.id ^ ((uint16_t)record.sender_id << 8);
+          if(record.header & MODE_BIT)
+            for(uint8_t i = 0; i < 4; i++) h = (h << 3 | h >> 13) ^ record.sender_bus_id[i];
+          h ^= h >> 7;
+          h = h * 0x9E5u;
+          return (h ^ (h >> 8)) & (RECENT_ID_TABLE_LENGTH - 1);
+        };
+
+        /* Take a place in recent_packet_ids out of the hash table. The entries
+           after it in the probe sequence move back, so no tombstone is left. */
+        void forget_recent_id(uint8_t place) {
+          uint16_t hole = recent_id_hash(recent_packet_ids[place]);
+          while(_recent_id_table[hole] != place) hole = (hole + 1) & (RECENT_ID_TABLE_LENGTH - 1);
+          uint16_t next = hole;
+          while(true) {
+            next = (next + 1) & (RECENT_ID_TABLE_LENGTH - 1);
+            if(_recent_id_table[next] == NO_SLOT) break;
+            uint16_t home = recent_id_hash(recent_packet_ids[_recent_id_table[next]]);
+            /* It can fill the hole if its home is not between the two */
+            if(((next - home) & (RECENT_ID_TABLE_LENGTH - 1)) >= ((next - hole) & (RECENT_ID_TABLE_LENGTH - 1))) {
+              _recent_id_table[hole] = _recent_id_table[next];
+              hole = next;
+            }
+          }
+          _recent_id_table[hole] = NO_SLOT;
+        };
+      #endif
+
+      #if(ORDERED_SENDING)
+        /* Packets to the same receiver are chained in the order they are to
+           be sent. Only the first of a chain is in the due queue, the next
+           one goes in when the first is removed or sent again. */
+        uint8_t _previous_for_receiver[MAX_PACKETS];
+        uint8_t _next_for_receiver[MAX_PACKETS];
+
+        bool same_receiver(uint8_t a, uint8_t b) const {
+          const uint8_t *one = (const uint8_t *)packets[a].content;
+          const uint8_t *two = (const uint8_t *)packets[b].content;
+          if(one[0] != two[0] || (one[1] & MODE_BIT) != (two[1] & MODE_BIT)) return false;
+          if(!(one[1] & MODE_BIT)) return true;
+          return bus_id_equality(
+            one + 3 + ((one[1] & EXTEND_HEADER_BIT) ? 1 : 0) + ((one[1] & EXTEND_LENGTH_BIT) ? 1 : 0),
+            two + 3 + ((two[1] & EXTEND_HEADER_BIT) ? 1 : 0) + ((two[1] & EXTEND_LENGTH_BIT) ? 1 : 0)
+          );
+        };
+
+        void link_to_receiver_tail(uint8_t index) {
+          _previous_for_receiver[index] = NO_SLOT;
+          _next_for_receiver[index] = NO_SLOT;
+          for(uint8_t i = 0; i < MAX_PACKETS; i++)
+            if(
+              i != index && packets[i].state != 0 &&
+              _next_for_receiver[i] == NO_SLOT && same_receiver(i, index)
+            ) {
+              _next_for_receiver[i] = index;
+              _previous_for_receiver[index] = i;
+              return;
+            }
+        };
+
+        void unlink_from_receiver(uint8_t index) {
+          uint8_t previous = _previous_for_receiver[index];
+          uint8_t next = _next_for_receiver[index];
+          if(previous != NO_SLOT) _next_for_receiver[previous] = next;
+          if(next != NO_SLOT) {
+            _previous_for_receiver[next] = previous;
+            if(previous == NO_SLOT && _due_position[next] == NOT_SCHEDULED) schedule(next);
+          }
+          _previous_for_receiver[index] = NO_SLOT;
+          _next_for_receiver[index] = NO_SLOT;
+        };
+
+        /* A packet sent again goes behind the ones dispatched since */
+        void requeue_for_receiver(uint8_t index) {
+          if(_next_for_receiver[index] == NO_SLOT) return;
+          unschedule(index);
+          unlink_from_receiver(index);
+          link_to_receiver_tail(index);
+        };
+      #endif
+
+      attempt_handler _attempt_handler;
       boolean   _auto_delete = true;
       error     _error;
       uint8_t   _mode;
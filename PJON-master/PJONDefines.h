@@ -41,6 +41,30 @@ limitations under the License. */
 
 #ifndef PJONDefines_h
   #define PJONDefines_h
+
+  /* CRC implementation, see utils/CRC8.h and utils/CRC32.h. All give the
+     same CRCs, they only trade memory for speed. The slicing ones need RAM
+     for their tables (up to 2kB for CRC8 and 8kB for CRC32) and are not
+     available on AVR. */
+  #define PJON_CRC_BITWISE     1
+  #define PJON_CRC_TABLE       2
+  #define PJON_CRC_SLICE_BY_4  4
+  #define PJON_CRC_SLICE_BY_8  8
+  #ifndef PJON_CRC_MODE
+    #if defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+      #define PJON_CRC_MODE PJON_CRC_BITWISE
+    #elif defined(__AVR__)
+      #define PJON_CRC_MODE PJON_CRC_TABLE
+    #elif defined(ARDUINO)
+      #define PJON_CRC_MODE PJON_CRC_SLICE_BY_4
+    #else
+      #define PJON_CRC_MODE PJON_CRC_SLICE_BY_8
+    #endif
+  #endif
+  #if defined(__AVR__) && PJON_CRC_MODE > PJON_CRC_TABLE
+    #error "PJON_CRC_SLICE_BY_4 and PJON_CRC_SLICE_BY_8 are not available on AVR"
+  #endif
+
   #include "utils/error.h"
   #include "utils/CRC8.h"
   #include "utils/CRC32.h"
@@ -115,6 +139,13 @@ limitations under the License. */
   #ifndef MAX_PACKETS
     #define MAX_PACKETS 5
   #endif
+  #if MAX_PACKETS > 254
+    #error MAX_PACKETS can be 254 at most
+  #endif
+  /* Send list slot that is not waiting in the due queue */
+  #define NOT_SCHEDULED  255
+  /* End of a chain of send list slots */
+  #define NO_SLOT        255
 
   /* Max packet length, higher if necessary.
      The max packet length defines the length of packets pre-allocated buffers
@@ -129,12 +160,24 @@ limitations under the License. */
     #define INCLUDE_ASYNC_ACK false
   #endif
 
-  /* Maximum packet ids record kept in memory (to avoid duplicated exchanges) */
+  /* Maximum packet ids record kept in memory (to avoid duplicated exchanges).
+     They are found through a hash table of at least twice as many bytes,
+     so a longer record costs memory but no time */
   #ifndef MAX_RECENT_PACKET_IDS
     #define MAX_RECENT_PACKET_IDS 10
   #endif
-
-  /* If set to true ensures packet ordered sending */
+  #if MAX_RECENT_PACKET_IDS > 254
+    #error MAX_RECENT_PACKET_IDS can be 254 at most
+  #endif
+  /* Length of their hash table, the power of 2 at least twice as long */
+  #define RECENT_ID_TABLE_LENGTH ( \
+    MAX_RECENT_PACKET_IDS <= 4 ? 8 : MAX_RECENT_PACKET_IDS <= 8 ? 16 : \
+    MAX_RECENT_PACKET_IDS <= 16 ? 32 : MAX_RECENT_PACKET_IDS <= 32 ? 64 : \
+    MAX_RECENT_PACKET_IDS <= 64 ? 128 : MAX_RECENT_PACKET_IDS <= 128 ? 256 : 512 \
+  )
+
+  /* If set to true ensures packet ordered sending: packets to the same
+     receiver are sent one after the other in the order they were dispatched */
   #ifndef ORDERED_SENDING
     #define ORDERED_SENDING false
   #endif
@@ -169,6 +212,13 @@ limitations under the License. */
     uint8_t  sender_bus_id[4];
   };
 
+  /* A piece of packet content. compose_fragments joins them in order, so
+     a header and a payload kept apart can be sent without joining them first */
+  struct PacketFragment {
+    const void *data;
+    uint16_t length;
+  };
+
   /* Last received packet Metainfo */
   struct PacketInfo {
     uint16_t header = 0;
@@ -181,8 +231,10 @@ limitations under the License. */
 
   typedef void (* receiver)(uint8_t *payload, uint16_t length, const PacketInfo &packet_info);
   typedef void (* error)(uint8_t code, uint8_t data);
+  typedef void (* attempt_handler)(uint16_t index, uint16_t response);
 
   static void dummy_receiver_handler(uint8_t *payload, uint16_t length, const PacketInfo &packet_info) {};
   static void dummy_error_handler(uint8_t code, uint8_t data) {};
+  static void dummy_attempt_handler(uint16_t index, uint16_t response) {};
 
 #endif
@@ -204,9 +204,10 @@
 #endif
 
 /* The default response timeout setup dedicates the transmission time of 1 byte plus
-   1 millisecond to latency and CRC computation. If receiver needs more than
-   SWBB_TIMEOUT to compute CRC and answer back ACK, transmitter will not receive
-   the incoming synchronous ACK. Higher or lower if necessary! */
+   1 millisecond to latency. The receiver computes the CRC while bytes arrive, so
+   after the last byte it only checks the result and answers. If receiver needs
+   more than SWBB_TIMEOUT to answer back ACK, transmitter will not receive the
+   incoming synchronous ACK. Higher or lower if necessary! */
 
 #ifndef SWBB_LATENCY
   #define SWBB_LATENCY 1000
@@ -1,11 +1,42 @@
-
 #pragma once
 
-  /* Compute CRC8 with a table-less implementation: */
+/* CRC8 (polynomial 0x8C reflected, Dallas/Maxim), computed one of four ways
+   selected with PJON_CRC_MODE (see PJONDefines.h). Every way gives the same
+   result as the original table-less loop, which is kept as compute_bitwise.
+   - PJON_CRC_BITWISE    8 shifts per byte, no table
+   - PJON_CRC_TABLE      1 lookup per byte in a 256 byte table, in PROGMEM on AVR
+   - PJON_CRC_SLICE_BY_4 4 or 8 tables of 256 bytes built in RAM on first use,
+     PJON_CRC_SLICE_BY_8 one per byte of a step (not on AVR) */
+
+#ifndef PROGMEM
+  #define PROGMEM
+#endif
+#ifndef pgm_read_byte
+  #define pgm_read_byte(address) (*(const uint8_t *)(address))
+#endif
+
+static const uint8_t PJON_CRC8_TABLE[256] PROGMEM = {
+  0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83, 0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41,
+  0x9D, 0xC3, 0x21, 0x7F, 0xFC, 0xA2, 0x40, 0x1E, 0x5F, 0x01, 0xE3, 0xBD, 0x3E, 0x60, 0x82, 0xDC,
+  0x23, 0x7D, 0x9F, 0xC1, 0x42, 0x1C, 0xFE, 0xA0, 0xE1, 0xBF, 0x5D, 0x03, 0x80, 0xDE, 0x3C, 0x62,
+  0xBE, 0xE0, 0x02, 0x5C, 0xDF, 0x81, 0x63, 0x3D, 0x7C, 0x22, 0xC0, 0x9E, 0x1D, 0x43, 0xA1, 0xFF,
+  0x46, 0x18, 0xFA, 0xA4, 0x27, 0x79, 0x9B, 0xC5, 0x84, 0xDA, 0x38, 0x66, 0xE5, 0xBB, 0x59, 0x07,
+  0xDB, 0x85, 0x67, 0x39, 0xBA, 0xE4, 0x06, 0x58, 0x19, 0x47, 0xA5, 0xFB, 0x78, 0x26, 0xC4, 0x9A,
+  0x65, 0x3B, 0xD9, 0x87, 0x04, 0x5A, 0xB8, 0xE6, 0xA7, 0xF9, 0x1B, 0x45, 0xC6, 0x98, 0x7A, 0x24,
+  0xF8, 0xA6, 0x44, 0x1A, 0x99, 0xC7, 0x25, 0x7B, 0x3A, 0x64, 0x86, 0xD8, 0x5B, 0x05, 0xE7, 0xB9,
+  0x8C, 0xD2, 0x30, 0x6E, 0xED, 0xB3, 0x51, 0x0F, 0x4E, 0x10, 0xF2, 0xAC, 0x2F, 0x71, 0x93, 0xCD,
+  0x11, 0x4F, 0xAD, 0xF3, 0x70, 0x2E, 0xCC, 0x92, 0xD3, 0x8D, 0x6F, 0x31, 0xB2, 0xEC, 0x0E, 0x50,
+  0xAF, 0xF1, 0x13, 0x4D, 0xCE, 0x90, 0x72, 0x2C, 0x6D, 0x33, 0xD1, 0x8F, 0x0C, 0x52, 0xB0, 0xEE,
+  0x32, 0x6C, 0x8E, 0xD0, 0x53, 0x0D, 0xEF, 0xB1, 0xF0, 0xAE, 0x4C, 0x12, 0x91, 0xCF, 0x2D, 0x73,
+  0xCA, 0x94, 0x76, 0x28, 0xAB, 0xF5, 0x17, 0x49, 0x08, 0x56, 0xB4, 0xEA, 0x69, 0x37, 0xD5, 0x8B,
+  0x57, 0x09, 0xEB, 0xB5, 0x36, 0x68, 0x8A, 0xD4, 0x95, 0xCB, 0x29, 0x77, 0xF4, 0xAA, 0x48, 0x16,
+  0xE9, 0xB7, 0x55, 0x0B, 0x88, 0xD6, 0x34, 0x6A, 0x2B, 0x75, 0x97, 0xC9, 0x4A, 0x14, 0xF6, 0xA8,
+  0x74, 0x2A, 0xC8, 0x96, 0x15, 0x4B, 0xA9, 0xF7, 0xB6, 0xE8, 0x0A, 0x54, 0xD7, 0x89, 0x6B, 0x35
+};
 
 struct crc8 {
 
-  static uint8_t roll(char input_byte, uint8_t crc) {
+  static uint8_t roll_bitwise(char input_byte, uint8_t crc) {
     for (uint8_t i = 8; i; i--, input_byte >>= 1) {
       uint8_t result = (crc ^ input_byte) & 0x01;
       crc >>= 1;
@@ -14,11 +45,77 @@ struct crc8 {
     return crc;
   };
 
-  static uint8_t compute(const uint8_t *input_byte, uint16_t length) {
-    uint8_t crc = 0;
+  static uint8_t roll_table(char input_byte, uint8_t crc) {
+    return pgm_read_byte(&PJON_CRC8_TABLE[(uint8_t)(crc ^ input_byte)]);
+  };
+
+  static uint8_t roll(char input_byte, uint8_t crc) {
+    #if PJON_CRC_MODE == PJON_CRC_BITWISE
+      return roll_bitwise(input_byte, crc);
+    #else
+      return roll_table(input_byte, crc);
+    #endif
+  };
+
+  static uint8_t compute_bitwise(const uint8_t *input_byte, uint16_t length, uint8_t crc = 0) {
+    for(uint16_t b = 0; b < length; b++)
+      crc = roll_bitwise(input_byte[b], crc);
+    return crc;
+  };
+
+  static uint8_t compute_table(const uint8_t *input_byte, uint16_t length, uint8_t crc = 0) {
     for(uint16_t b = 0; b < length; b++)
-      crc = roll(input_byte[b], crc);
+      crc = pgm_read_byte(&PJON_CRC8_TABLE[crc ^ input_byte[b]]);
     return crc;
   };
 
+#if !defined(__AVR__)
+  /* slices[k][i] is the CRC of byte i followed by k zero bytes. Slice by 4
+     only builds 4 of them. */
+  template<uint8_t N> struct slice_tables {
+    uint8_t slices[N][256];
+    slice_tables() {
+      for(uint16_t i = 0; i < 256; i++) slices[0][i] = pgm_read_byte(&PJON_CRC8_TABLE[i]);
+      for(uint8_t k = 1; k < N; k++)
+        for(uint16_t i = 0; i < 256; i++)
+          slices[k][i] = pgm_read_byte(&PJON_CRC8_TABLE[slices[k - 1][i]]);
+    };
+  };
+
+  template<uint8_t N> static const slice_tables<N> &tables() {
+    static const slice_tables<N> built;
+    return built;
+  };
+
+  static uint8_t compute_slice_by_4(const uint8_t *input_byte, uint16_t length, uint8_t crc = 0) {
+    const slice_tables<4> &t = tables<4>();
+    for(; length >= 4; length -= 4, input_byte += 4)
+      crc = t.slices[3][crc ^ input_byte[0]] ^ t.slices[2][input_byte[1]] ^
+            t.slices[1][input_byte[2]] ^ t.slices[0][input_byte[3]];
+    return compute_table(input_byte, length, crc);
+  };
+
+  static uint8_t compute_slice_by_8(const uint8_t *input_byte, uint16_t length, uint8_t crc = 0) {
+    const slice_tables<8> &t = tables<8>();
+    for(; length >= 8; length -= 8, input_byte += 8)
+      crc = t.slices[7][crc ^ input_byte[0]] ^ t.slices[6][input_byte[1]] ^
+            t.slices[5][input_byte[2]] ^ t.slices[4][input_byte[3]] ^
+            t.slices[3][input_byte[4]] ^ t.slices[2][input_byte[5]] ^
+            t.slices[1][input_byte[6]] ^ t.slices[0][input_byte[7]];
+    return compute_table(input_byte, length, crc);
+  };
+#endif
+
+  static uint8_t compute(const uint8_t *input_byte, uint16_t length, uint8_t crc = 0) {
+    #if PJON_CRC_MODE == PJON_CRC_BITWISE
+      return compute_bitwise(input_byte, length, crc);
+    #elif PJON_CRC_MODE == PJON_CRC_TABLE
+      return compute_table(input_byte, length, crc);
+    #elif PJON_CRC_MODE == PJON_CRC_SLICE_BY_4
+      return compute_slice_by_4(input_byte, length, crc);
+    #else
+      return compute_slice_by_8(input_byte, length, crc);
+    #endif
+  };
+
 };
@@ -1,3 +1,4 @@
+#include <GameCommUtils.h>
 
 typedef byte pot_pos_t;
 
@@ -14,6 +15,13 @@ typedef byte pot_pos_t;
 #define LOCK_BUTTON A0
 #define RESET_BUTTON A1
 
+// The default comm pin is POT_PIN_B
+#define SHIP_WHEEL_COMM_PIN 12
+
+// State record mirrored to the controller with setStateField(). The raw wheel position goes to the
+// controller from the ISRs as CE_DIAL_POSITION.
+#define SW_STATE_DIAL_POSITION  0   // 1 to the number of LED pairs, 99 between positions
+
 // TEMP
 bool pFirst = false;
 unsigned long timeLastDebug = millis();
@@ -554,6 +562,10 @@ class ShipWheelGame {
       return gameDial;
     }
 
+    byte getDialPosition() {
+      return dialPos;
+    }
+
     void addLEDPair(LEDPair* p) {
       if (numLedPairs < MAX_LED_PAIRS) {
         ledPairs[numLedPairs] = p;
@@ -640,6 +652,9 @@ void setup() {
   Serial.begin(115200); // start the serial monitor link
   while (!Serial);
 
+  initOverrideComm(SHIP_WHEEL_LOCK_NODE, SHIP_WHEEL_COMM_PIN);
+  schedulePeriodic(0, commTask);
+
   Potentiometer* potent = initiaizePotentiometer();
 
   swGameInstance = initializeShipWheelGame(potent);
@@ -672,15 +687,31 @@ Potentiometer* initiaizePotentiometer() {
   return newPot;
 }
 
+/**
+ * Report a change of the potentiometer position to the controller. Runs in the ISR, so the position is only
+ * stored, doComm() sends the latest one. A fast turn between two doComm() passes is one event.
+ */
+void reportPotPosition(Potentiometer* pot, pot_pos_t before) {
+  if (pot->getCurrentPosition() != before) {
+    setLatestFromISR(GAME_CONTROLLER_NODE, CE_DIAL_POSITION, pot->getCurrentPosition());
+  }
+}
+
 void potentPinAInteruptHandler() {
   cli(); //stop interrupts happening before we read pin values
-  swGameInstance->getDial()->getPotentiometer()->processInteruptPinA();
+  Potentiometer* pot = swGameInstance->getDial()->getPotentiometer();
+  pot_pos_t before = pot->getCurrentPosition();
+  pot->processInteruptPinA();
+  reportPotPosition(pot, before);
   sei(); //restart interrupts
 }
 
 void potentPinBInteruptHandler() {
   cli(); //stop interrupts happening before we read pin values
-  swGameInstance->getDial()->getPotentiometer()->processInteruptPinB();
+  Potentiometer* pot = swGameInstance->getDial()->getPotentiometer();
+  pot_pos_t before = pot->getCurrentPosition();
+  pot->processInteruptPinB();
+  reportPotPosition(pot, before);
   sei(); //restart interrupts
 }
 
@@ -721,6 +752,13 @@ ShipWheelGame* initializeShipWheelGame(Potentiometer* p) {
   return game;
 }
 
+/**
+ * Copy the dial position into the state record. Only a change goes to the controller.
+ */
+void updateStateRecord() {
+  setStateField(SW_STATE_DIAL_POSITION, swGameInstance->getDialPosition());
+}
+
 /**
    ---------------------------------------------------------------------------
    MAIN LOOP
@@ -728,7 +766,10 @@ ShipWheelGame* initializeShipWheelGame(Potentiometer* p) {
 */
 void loop() {
 
+  runScheduler();
+
   swGameInstance->updateStatus();
+  updateStateRecord();
 
   if (oldEncPos != swGameInstance->getDial()->getPotentiometer()->getCurrentPosition()) {
     Serial.print(F("Pr, Pc "));